@@ -0,0 +1,302 @@
+// Nearest-waypoint query time against map size.
+//
+// Compares the linear scan the planner used to do with the grid index in HighwayMap,
+// on the Bosch map and on synthetic winding routes of up to 1M waypoints. The last
+// columns are the cost of getFrenet() along a trajectory through a FrenetCursor and through
+// getFrenetBatch(), and the largest difference of the batch s,d and x,y from the scalar ones.
+// A second table shows memory and position error of the resampled reference line per resolution,
+// a third one the spline reference line against the waypoint segments. The last one drives along
+// a long synthetic route streamed through a TiledMap and compares it with the whole route in memory.
+//
+// usage: map_benchmark [map file]
+
+#include <math.h>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/highway_map.h"
+#include "../src/tiled_map.h"
+
+using namespace std;
+
+namespace {
+
+// results of the timed loops, printed so the compiler cannot drop them
+double checksum = 0.0;
+
+int linearClosest(double x, double y, const TableView<double> &maps_x, const TableView<double> &maps_y) {
+    double closestLen = 1e300;
+    int closestWaypoint = 0;
+    for (size_t i = 0; i < maps_x.size(); i++) {
+        double dist = (x - maps_x[i]) * (x - maps_x[i]) + (y - maps_y[i]) * (y - maps_y[i]);
+        if (dist < closestLen) {
+            closestLen = dist;
+            closestWaypoint = i;
+        }
+    }
+    return closestWaypoint;
+}
+
+// a route with waypoints ~30m apart and a slowly wandering heading, like a long highway
+void syntheticRoute(int n, HighwayMap &map, const char *csv_file = nullptr, bool closed = true) {
+    vector<double> x(n), y(n), s(n), dx(n), dy(n);
+    double heading = 0.0, px = 0.0, py = 0.0, ps = 0.0;
+    for (int i = 0; i < n; i++) {
+        heading = 0.6 * sin(i / 150.0) + 0.3 * sin(i / 1700.0);
+        x[i] = px;
+        y[i] = py;
+        s[i] = ps;
+        dx[i] = sin(heading);
+        dy[i] = -cos(heading);
+        px += 30.0 * cos(heading);
+        py += 30.0 * sin(heading);
+        ps += 30.0;
+    }
+    map.build(x, y, s, dx, dy, closed);
+
+    if (csv_file) {
+        FILE *out = fopen(csv_file, "w");
+        for (int i = 0; i < n; i++)
+            fprintf(out, "%.17g %.17g %.17g %.17g %.17g\n", x[i], y[i], s[i], dx[i], dy[i]);
+        fclose(out);
+    }
+}
+
+void runTiled(int n, int tile_waypoints) {
+
+    const char *csv_file = "/tmp/map_benchmark_route.csv";
+    HighwayMap whole;
+    syntheticRoute(n, whole, csv_file, false);
+
+    TiledMap tiled(tile_waypoints);
+    if (!tiled.open(csv_file)) {
+        printf("could not read %s\n", csv_file);
+        return;
+    }
+
+    // drive the route at 20m/s, 15 of the 75 points ahead of the ego every 0.02s tick like the planner,
+    // up to the last waypoint, the whole route is open like its tiles
+    double max_diff = 0.0, query_us = 0.0;
+    int max_resident = 0, queries = 0;
+    vector<double> ps(15), pd(15), ptheta(15, 0.0), qx(15), qy(15), qs(15), qd(15);
+    for (double ego_s = 0.0; ego_s + 2.0 * 14 <= tiled.endS(); ego_s += 0.4) {
+        tiled.update(ego_s);
+        max_resident = max(max_resident, tiled.residentTiles());
+
+        double d = 2.0 + 4.0 * (int(ego_s / 1000.0) % 3);
+        for (int k = 0; k < 15; k++) {
+            ps[k] = ego_s + 2.0 * k;
+            pd[k] = d;
+        }
+        auto t0 = chrono::steady_clock::now();
+        tiled.getXYBatch(ps.data(), pd.data(), 15, qx.data(), qy.data());
+        tiled.getFrenetBatch(qx.data(), qy.data(), ptheta.data(), 15, qs.data(), qd.data());
+        auto t1 = chrono::steady_clock::now();
+        query_us += chrono::duration<double, micro>(t1 - t0).count();
+        queries += 15;
+
+        // against the whole route in memory
+        for (int k = 0; k < 15; k++) {
+            vector<double> xy = whole.getXY(ps[k], d);
+            vector<double> sd = whole.getFrenet(qx[k], qy[k], 0.0);
+            max_diff = max(max_diff, max(fabs(xy[0] - qx[k]), fabs(xy[1] - qy[k])));
+            max_diff = max(max_diff, max(fabs(sd[0] - qs[k]), fabs(sd[1] - qd[k])));
+        }
+    }
+
+    printf("%-12s %9d %9d %9d %9d %12.3f %10.2g\n", "tiled", n, tile_waypoints, tiled.tiles(), max_resident,
+           query_us / queries, max_diff);
+    remove(csv_file);
+}
+
+void run(const char *name, const HighwayMap &map) {
+
+    // query points on the lanes, spread along the whole route
+    mt19937 gen(42);
+    uniform_real_distribution<double> s_dist(0.0, map.s().back());
+    uniform_real_distribution<double> d_dist(0.0, 12.0);
+    const int queries = 2000;
+    vector<double> qx(queries), qy(queries);
+    for (int i = 0; i < queries; i++) {
+        vector<double> xy = map.getXY(s_dist(gen), d_dist(gen));
+        qx[i] = xy[0];
+        qy[i] = xy[1];
+    }
+
+    // the linear scan gets fewer queries on big maps to keep the run short
+    int linear_queries = max(20, min(queries, int(2e8 / map.size())));
+    int mismatches = 0;
+
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i < linear_queries; i++)
+        checksum += linearClosest(qx[i], qy[i], map.x(), map.y());
+    auto t1 = chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++)
+        checksum += map.ClosestWaypoint(qx[i], qy[i]);
+    auto t2 = chrono::steady_clock::now();
+
+    for (int i = 0; i < linear_queries; i++)
+        if (linearClosest(qx[i], qy[i], map.x(), map.y()) != map.ClosestWaypoint(qx[i], qy[i]))
+            mismatches++;
+
+    // trajectory sweeps: 75 points 0.4m apart, like getTrajectoryReadings()
+    const int sweeps = 200;
+    vector<double> sweep_s(sweeps), sweep_d(sweeps);
+    for (int i = 0; i < sweeps; i++) {
+        sweep_s[i] = s_dist(gen) * 0.99;
+        sweep_d[i] = d_dist(gen);
+    }
+    vector<double> px(75 * sweeps), py(75 * sweeps), ptheta(75 * sweeps);
+    for (int i = 0; i < sweeps; i++) {
+        for (int k = 0; k < 75; k++) {
+            vector<double> p = map.getXY(sweep_s[i] + 0.4 * k, sweep_d[i]);
+            vector<double> q = map.getXY(sweep_s[i] + 0.4 * (k + 1), sweep_d[i]);
+            px[i * 75 + k] = p[0];
+            py[i * 75 + k] = p[1];
+            ptheta[i * 75 + k] = atan2(q[1] - p[1], q[0] - p[0]);
+        }
+    }
+    auto t3 = chrono::steady_clock::now();
+    for (int i = 0; i < sweeps; i++) {
+        FrenetCursor cursor(map);
+        for (int k = i * 75; k < (i + 1) * 75; k++)
+            checksum += cursor.getFrenet(px[k], py[k], ptheta[k])[0];
+    }
+    auto t4 = chrono::steady_clock::now();
+    vector<double> batch_s(75 * sweeps), batch_d(75 * sweeps);
+    for (int i = 0; i < sweeps; i++)
+        map.getFrenetBatch(&px[i * 75], &py[i * 75], &ptheta[i * 75], 75, &batch_s[i * 75], &batch_d[i * 75]);
+    auto t5 = chrono::steady_clock::now();
+
+    // batch results against the scalar functions
+    double max_diff = 0.0;
+    for (int k = 0; k < 75 * sweeps; k++) {
+        vector<double> sd = map.getFrenet(px[k], py[k], ptheta[k]);
+        max_diff = max(max_diff, max(fabs(sd[0] - batch_s[k]), fabs(sd[1] - batch_d[k])));
+    }
+    vector<double> batch_x(75 * sweeps), batch_y(75 * sweeps);
+    map.getXYBatch(batch_s.data(), batch_d.data(), 75 * sweeps, batch_x.data(), batch_y.data());
+    for (int k = 0; k < 75 * sweeps; k++) {
+        vector<double> xy = map.getXY(batch_s[k], batch_d[k]);
+        max_diff = max(max_diff, max(fabs(xy[0] - batch_x[k]), fabs(xy[1] - batch_y[k])));
+    }
+
+    double linear_us = chrono::duration<double, micro>(t1 - t0).count() / linear_queries;
+    double grid_us = chrono::duration<double, micro>(t2 - t1).count() / queries;
+    double cursor_us = chrono::duration<double, micro>(t4 - t3).count() / (75 * sweeps);
+    double batch_us = chrono::duration<double, micro>(t5 - t4).count() / (75 * sweeps);
+
+    printf("%-12s %9d %12.3f %12.3f %9.1fx %6d %12.3f %12.3f %10.2g\n", name, map.size(), linear_us, grid_us,
+           linear_us / grid_us, mismatches, cursor_us, batch_us, max_diff);
+}
+
+}
+
+int main(int argc, char **argv) {
+
+    string map_file = argc > 1 ? argv[1] : "../highway_map_bosch1.csv";
+
+    printf("%-12s %9s %12s %12s %10s %6s %12s %12s %10s\n", "map", "waypoints", "linear [us]", "grid [us]", "speedup",
+           "diff", "cursor [us]", "batch [us]", "batch err");
+
+    HighwayMap bosch;
+    if (bosch.load(map_file))
+        run("bosch", bosch);
+    else
+        printf("%-12s could not read %s\n", "bosch", map_file.c_str());
+
+    for (int n = 2500; n <= 1000000; n *= 4) {
+        HighwayMap map;
+        syntheticRoute(n, map);
+        run("synthetic", map);
+    }
+    {
+        HighwayMap map;
+        syntheticRoute(1000000, map);
+        run("synthetic", map);
+    }
+
+    if (!bosch.empty()) {
+        HighwayMap segments, smooth;
+        segments.load(map_file);
+        smooth.load(map_file);
+        smooth.fitSpline();
+
+        mt19937 gen(11);
+        uniform_real_distribution<double> s_dist(0.0, bosch.s().back() - 50.0);
+        uniform_real_distribution<double> d_dist(0.0, 12.0);
+        const int queries = 20000;
+        vector<double> qs(queries), qd(queries), qx(queries), qy(queries), qtheta(queries);
+        for (int i = 0; i < queries; i++) {
+            qs[i] = s_dist(gen);
+            qd[i] = d_dist(gen);
+        }
+
+        printf("\n%-12s %12s %12s %14s %14s\n", "reference", "getXY [us]", "getFrenet [us]", "round trip [m]",
+               "to segments [m]");
+        const HighwayMap *lines[] = {&segments, &smooth};
+        const char *names[] = {"segments", "spline"};
+        for (int l = 0; l < 2; l++) {
+            const HighwayMap &map = *lines[l];
+            auto t0 = chrono::steady_clock::now();
+            for (int i = 0; i < queries; i++) {
+                vector<double> xy = map.getXY(qs[i], qd[i]);
+                qx[i] = xy[0];
+                qy[i] = xy[1];
+            }
+            auto t1 = chrono::steady_clock::now();
+            double round_trip = 0.0, to_segments = 0.0;
+            for (int i = 0; i < queries; i++) {
+                vector<double> ahead = map.getXY(qs[i] + 0.5, qd[i]);
+                qtheta[i] = atan2(ahead[1] - qy[i], ahead[0] - qx[i]);
+            }
+            auto t2 = chrono::steady_clock::now();
+            for (int i = 0; i < queries; i++) {
+                vector<double> sd = map.getFrenet(qx[i], qy[i], qtheta[i]);
+                round_trip = max(round_trip, max(fabs(sd[0] - qs[i]), fabs(sd[1] - qd[i])));
+            }
+            auto t3 = chrono::steady_clock::now();
+            for (int i = 0; i < queries; i++) {
+                vector<double> xy = segments.getXY(qs[i], 0.0);
+                vector<double> ref = map.getXY(qs[i], 0.0);
+                to_segments = max(to_segments, sqrt((xy[0] - ref[0]) * (xy[0] - ref[0]) + (xy[1] - ref[1]) * (xy[1] - ref[1])));
+            }
+
+            printf("%-12s %12.4f %14.4f %14.2e %15.2e\n", names[l],
+                   chrono::duration<double, micro>(t1 - t0).count() / queries,
+                   chrono::duration<double, micro>(t3 - t2).count() / queries, round_trip, to_segments);
+        }
+
+        printf("\n%-12s %9s %12s %12s %12s %12s\n", "resample", "samples", "memory [kB]", "max err [m]", "rms err [m]",
+               "getXY [us]");
+
+        const double resolutions[] = {0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0, 0.0};
+        for (double ds: resolutions) {
+            bosch.resample(ds);
+            HighwayMap::ResampleStats stats = bosch.resampleStats();
+
+            mt19937 gen(7);
+            uniform_real_distribution<double> s_dist(0.0, bosch.s().back());
+            const int queries = 100000;
+            vector<double> qs(queries), qd(queries, 6.0), qx(queries), qy(queries);
+            for (int i = 0; i < queries; i++)
+                qs[i] = s_dist(gen);
+            auto t0 = chrono::steady_clock::now();
+            bosch.getXYBatch(qs.data(), qd.data(), queries, qx.data(), qy.data());
+            auto t1 = chrono::steady_clock::now();
+
+            printf("%-12.2f %9d %12.1f %12.2e %12.2e %12.4f\n", ds, stats.samples, stats.bytes / 1024.0,
+                   stats.max_error, stats.rms_error, chrono::duration<double, micro>(t1 - t0).count() / queries);
+        }
+    }
+
+    printf("\n%-12s %9s %9s %9s %9s %12s %10s\n", "streaming", "waypoints", "per tile", "tiles", "resident",
+           "query [us]", "whole err");
+    runTiled(100000, 256);
+    runTiled(100000, 1024);
+
+    printf("\nchecksum %.17g\n", checksum);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef ARC_LENGTH_TABLE_H
+#define ARC_LENGTH_TABLE_H
+
+#include <math.h>
+#include <algorithm>
+#include <array>
+
+// Arc length along the graph y = f(x) of a spline, tabulated between x0 and x1 so the x at a
+// given distance along the curve is a table lookup plus one Newton step instead of a chord
+// approximation. Works with tk::spline and tk::fixed_spline, the table lives in std::arrays.
+template<class Spline>
+class ArcLengthTable {
+public:
+    static const int kMaxIntervals = 128;
+
+    ArcLengthTable(): f_(nullptr), intervals_(0) {}
+
+    void build(const Spline &f, double x0, double x1, int intervals = 64) {
+        f_ = &f;
+        intervals_ = std::max(1, std::min(intervals, int(kMaxIntervals)));
+        double dx = (x1 - x0) / intervals_;
+        x_[0] = x0;
+        s_[0] = 0.0;
+        for (int k = 1; k <= intervals_; k++) {
+            x_[k] = x0 + k * dx;
+            s_[k] = s_[k - 1] + integrate(x_[k - 1], x_[k]);
+        }
+    }
+
+    double length() const { return s_[intervals_]; }
+
+    // x where the arc length from x0 reaches s, past the table the curve is taken as straight
+    double xAt(double s) const {
+        int k = int(std::upper_bound(s_.begin(), s_.begin() + intervals_ + 1, s) - s_.begin()) - 1;
+        k = std::max(0, std::min(k, intervals_ - 1));
+        return refine(k, s);
+    }
+
+    // xs[i] = xAt(s[i]) for increasing s, walking the table instead of searching it
+    void xAtSorted(const double *s, int n, double *xs) const {
+        int k = 0;
+        for (int i = 0; i < n; i++) {
+            while (k + 1 < intervals_ && s_[k + 1] <= s[i])
+                k++;
+            xs[i] = refine(k, s[i]);
+        }
+    }
+
+private:
+    // arc length between a and b, 3-point Gauss-Legendre on sqrt(1 + f'^2)
+    double integrate(double a, double b) const {
+        const double node = sqrt(0.6);
+        double mid = 0.5 * (a + b), half = 0.5 * (b - a);
+        return half * (5.0 / 9.0 * speed(mid - half * node) + 8.0 / 9.0 * speed(mid) +
+                       5.0 / 9.0 * speed(mid + half * node));
+    }
+
+    double speed(double x) const {
+        double d1 = f_->deriv(x, 1);
+        return sqrt(1.0 + d1 * d1);
+    }
+
+    // linear guess inside interval k, then one Newton step on the integrated arc length
+    double refine(int k, double s) const {
+        double ds = s_[k + 1] - s_[k];
+        double x = ds > 0 ? x_[k] + (s - s_[k]) / ds * (x_[k + 1] - x_[k]) : x_[k];
+        return x - (integrate(x_[k], x) - (s - s_[k])) / speed(x);
+    }
+
+    const Spline *f_;
+    int intervals_;
+    std::array<double, kMaxIntervals + 1> x_, s_;
+};
+
+#endif /* ARC_LENGTH_TABLE_H */
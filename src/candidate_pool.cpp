@@ -0,0 +1,48 @@
+#include "candidate_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+CandidatePool::CandidatePool(int threads): threads_(max(threads, 0)), fn_(nullptr), n_(0), next_(0), pending_(0) {
+    if (threads_ > 0)
+        pool_.reset(new Eigen::NonBlockingThreadPool(threads_));
+}
+
+CandidatePool::~CandidatePool() {
+    // joins the workers, run() does not return before its tasks are done so none are left
+    pool_.reset();
+}
+
+void CandidatePool::drain(int worker) {
+    for (int i = next_.fetch_add(1); i < n_; i = next_.fetch_add(1))
+        (*fn_)(i, worker);
+}
+
+void CandidatePool::run(int n, const function<void(int, int)> &fn) {
+
+    if (n <= 0)
+        return;
+
+    fn_ = &fn;
+    n_ = n;
+    next_ = 0;
+
+    // the calling thread takes candidates too, so one task fewer than candidates is enough
+    int tasks = min(threads_, n - 1);
+    pending_ = tasks;
+    for (int t = 0; t < tasks; t++) {
+        pool_->Schedule([this]() {
+            drain(pool_->CurrentThreadId());
+            lock_guard<mutex> lock(mutex_);
+            if (--pending_ == 0)
+                done_.notify_one();
+        });
+    }
+
+    drain(threads_);
+
+    unique_lock<mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0; });
+    fn_ = nullptr;
+}
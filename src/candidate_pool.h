@@ -0,0 +1,84 @@
+#ifndef CANDIDATE_POOL_H
+#define CANDIDATE_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#define EIGEN_USE_THREADS
+#include <unsupported/Eigen/CXX11/ThreadPool>
+
+// Persistent worker threads for evaluating planner candidates.
+//
+// run() schedules one task per worker of an Eigen NonBlockingThreadPool, and every task and the
+// calling thread drain one shared atomic index, taking the next candidate until none are left. A
+// worker that finishes its candidates early simply takes more from the index. Every call gets the
+// index of the worker that runs it, so it can use that worker's scratch space without locking. Results should be written per candidate and reduced
+// by the caller in candidate order, then they do not depend on the number of threads.
+class CandidatePool {
+public:
+    // threads <= 0 evaluates every candidate on the calling thread
+    explicit CandidatePool(int threads);
+    ~CandidatePool();
+
+    // Threads that may run candidates, the calling thread included. Worker indices are below this.
+    int workers() const { return threads_ + 1; }
+
+    // Call fn(candidate, worker) for every candidate in [0, n) and return when all are done
+    void run(int n, const std::function<void(int, int)> &fn);
+
+private:
+    CandidatePool(const CandidatePool &);
+    CandidatePool &operator=(const CandidatePool &);
+
+    void drain(int worker);
+
+    int threads_;
+    std::unique_ptr<Eigen::NonBlockingThreadPool> pool_;
+
+    // state of the current run(), only one runs at a time
+    const std::function<void(int, int)> *fn_;
+    int n_;
+    std::atomic<int> next_;
+    int pending_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+};
+
+// One T per worker of a CandidatePool, each starting on its own cache line so workers never share one
+template<class T>
+class PerWorker {
+public:
+    static const size_t kCacheLine = 64;
+
+    explicit PerWorker(int workers): workers_(workers) {
+        stride_ = (sizeof(T) + kCacheLine - 1) / kCacheLine * kCacheLine;
+        storage_.reset(new char[stride_ * workers + kCacheLine]);
+        uintptr_t base = reinterpret_cast<uintptr_t>(storage_.get());
+        base_ = storage_.get() + (kCacheLine - base % kCacheLine) % kCacheLine;
+        for (int i = 0; i < workers_; i++)
+            new (base_ + i * stride_) T();
+    }
+
+    ~PerWorker() {
+        for (int i = 0; i < workers_; i++)
+            (*this)[i].~T();
+    }
+
+    T &operator[](int worker) { return *reinterpret_cast<T *>(base_ + worker * stride_); }
+
+private:
+    PerWorker(const PerWorker &);
+    PerWorker &operator=(const PerWorker &);
+
+    int workers_;
+    size_t stride_;
+    std::unique_ptr<char[]> storage_;
+    char *base_;
+};
+
+#endif /* CANDIDATE_POOL_H */
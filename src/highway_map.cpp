@@ -0,0 +1,769 @@
+#include "highway_map.h"
+
+#include <math.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+double distance(double x1, double y1, double x2, double y2) {
+    return sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+}
+
+// x86-64 builds with GCC get an AVX2 clone of the batch kernels next to the generic one,
+// the loader picks the one the CPU supports
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define MAP_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define MAP_KERNEL
+#endif
+
+// points are handled in chunks so the segment indices fit on the stack
+const int kBatchChunk = 64;
+
+MAP_KERNEL
+void frenetKernel(const double *__restrict x, const double *__restrict y, const int *__restrict seg, int n,
+                  const double *__restrict maps_x, const double *__restrict maps_y, const double *__restrict cum_s,
+                  const double *__restrict seg_cos, const double *__restrict seg_sin,
+                  const double *__restrict seg_nx, const double *__restrict seg_ny, bool closed,
+                  double *__restrict s, double *__restrict d) {
+    for (int i = 0; i < n; i++) {
+        int k = seg[i];
+        double x_x = x[i] - maps_x[k];
+        double x_y = y[i] - maps_y[k];
+        double along = x_x * seg_cos[k] + x_y * seg_sin[k];
+        s[i] = cum_s[k] + (closed || k > 0 ? fabs(along) : along);
+        d[i] = x_x * seg_nx[k] + x_y * seg_ny[k];
+    }
+}
+
+MAP_KERNEL
+void xyKernel(const double *__restrict s, const double *__restrict d, const int *__restrict seg, int n,
+              const double *__restrict maps_x, const double *__restrict maps_y, const double *__restrict maps_s,
+              const double *__restrict seg_cos, const double *__restrict seg_sin,
+              const double *__restrict seg_nx, const double *__restrict seg_ny,
+              double *__restrict x, double *__restrict y) {
+    for (int i = 0; i < n; i++) {
+        int k = seg[i];
+        double seg_s = s[i] - maps_s[k];
+        x[i] = maps_x[k] + seg_s * seg_cos[k] + d[i] * seg_nx[k];
+        y[i] = maps_y[k] + seg_s * seg_sin[k] + d[i] * seg_ny[k];
+    }
+}
+
+// position on the resampled line, linear between the samples around s and extrapolated past both ends
+inline void sampledXY(double s, double d, double s0, double inv_ds, int samples,
+                      const double *__restrict sample_x, const double *__restrict sample_y,
+                      const double *__restrict sample_nx, const double *__restrict sample_ny,
+                      double &x, double &y) {
+    double u = (s - s0) * inv_ds;
+    int k = int(min(max(u, 0.0), samples - 2.0));
+    double t = u - k;
+    double nx = sample_nx[k] + t * (sample_nx[k + 1] - sample_nx[k]);
+    double ny = sample_ny[k] + t * (sample_ny[k + 1] - sample_ny[k]);
+    x = sample_x[k] + t * (sample_x[k + 1] - sample_x[k]) + d * nx;
+    y = sample_y[k] + t * (sample_y[k + 1] - sample_y[k]) + d * ny;
+}
+
+// s,d of points on the resampled line, the inverse of sampledXY(): the point is sample seg + t plus d times
+// the normal interpolated at t. Solved for t and d with Newton steps from the projection onto the chord.
+const int kSampledFrenetSteps = 3;
+
+MAP_KERNEL
+void sampledFrenetKernel(const double *__restrict x, const double *__restrict y, const int *__restrict seg, int n,
+                         double s0, double ds, const double *__restrict sample_x, const double *__restrict sample_y,
+                         const double *__restrict sample_nx, const double *__restrict sample_ny,
+                         double *__restrict s, double *__restrict d) {
+    for (int i = 0; i < n; i++) {
+        int k = seg[i];
+        double px = x[i] - sample_x[k], py = y[i] - sample_y[k];
+        double ex = sample_x[k + 1] - sample_x[k], ey = sample_y[k + 1] - sample_y[k];
+        double nx = sample_nx[k], ny = sample_ny[k];
+        double dnx = sample_nx[k + 1] - nx, dny = sample_ny[k + 1] - ny;
+
+        double t = (px * ex + py * ey) / (ex * ex + ey * ey);
+        double off = px * nx + py * ny;
+        for (int step = 0; step < kSampledFrenetSteps; step++) {
+            double mx = nx + t * dnx, my = ny + t * dny;
+            double rx = t * ex + off * mx - px, ry = t * ey + off * my - py;
+            double jx = ex + off * dnx, jy = ey + off * dny;
+            double det = jx * my - mx * jy;
+            t -= (my * rx - mx * ry) / det;
+            off -= (jx * ry - jy * rx) / det;
+        }
+        s[i] = s0 + (k + t) * ds;
+        d[i] = off;
+    }
+}
+
+MAP_KERNEL
+void sampledXYKernel(const double *__restrict s, const double *__restrict d, int n,
+                     double s0, double inv_ds, int samples,
+                     const double *__restrict sample_x, const double *__restrict sample_y,
+                     const double *__restrict sample_nx, const double *__restrict sample_ny,
+                     double *__restrict x, double *__restrict y) {
+    for (int i = 0; i < n; i++)
+        sampledXY(s[i], d[i], s0, inv_ds, samples, sample_x, sample_y, sample_nx, sample_ny, x[i], y[i]);
+}
+
+}
+
+bool HighwayMap::load(const string &map_file) {
+
+    if (isCompiledMap(map_file))
+        return mapCompiled(map_file);
+
+    return readCSV(map_file);
+}
+
+bool HighwayMap::readCSV(const string &map_file) {
+
+    vector<double> map_waypoints_x;
+    vector<double> map_waypoints_y;
+    vector<double> map_waypoints_s;
+    vector<double> map_waypoints_dx;
+    vector<double> map_waypoints_dy;
+
+    ifstream in_map_(map_file.c_str(), ifstream::in);
+
+    // A file caught halfway through being written is rejected rather than loaded as a shorter map:
+    // every line has to parse completely and the last one has to end in a newline.
+    string line;
+    while (getline(in_map_, line)) {
+        if (in_map_.eof())
+            return false;
+        istringstream iss(line);
+        double x;
+        double y;
+        double s;
+        double d_x;
+        double d_y;
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        if (!(iss >> x >> y >> s >> d_x >> d_y) || !(iss >> ws).eof())
+            return false;
+        map_waypoints_x.push_back(x);
+        map_waypoints_y.push_back(y);
+        map_waypoints_s.push_back(s);
+        map_waypoints_dx.push_back(d_x);
+        map_waypoints_dy.push_back(d_y);
+    }
+
+    if (map_waypoints_x.empty())
+        return false;
+
+    build(map_waypoints_x, map_waypoints_y, map_waypoints_s, map_waypoints_dx, map_waypoints_dy);
+    return true;
+}
+
+bool HighwayMap::mapCompiled(const string &map_file) {
+
+    MappedFile file;
+    if (!file.open(map_file) || file.size() < sizeof(MapFileHeader))
+        return false;
+
+    MapFileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    uint64_t n = header.waypoints;
+    uint64_t cells = uint64_t(header.grid_cols) * header.grid_rows;
+    bool valid = memcmp(header.magic, kMapFileMagic, sizeof(kMapFileMagic)) == 0 &&
+                 header.version == kMapFileVersion &&
+                 header.byte_order == kMapFileByteOrder &&
+                 header.tables == kTables &&
+                 n > 0 && cells > 0 &&
+                 header.file_size == file.size() &&
+                 header.tables_offset % sizeof(double) == 0 &&
+                 header.tables_offset + kTables * n * sizeof(double) <= header.grid_offset &&
+                 header.grid_offset + (cells + 1 + n) * sizeof(int32_t) <= header.file_size;
+    if (!valid)
+        return false;
+
+    MapTables tables;
+    tables.waypoints = n;
+    tables.tables = header.tables;
+    tables.table_block = reinterpret_cast<const double *>(file.data() + header.tables_offset);
+    tables.grid_cols = header.grid_cols;
+    tables.grid_rows = header.grid_rows;
+    tables.grid_cell = header.grid_cell;
+    tables.grid_min_x = header.grid_min_x;
+    tables.grid_min_y = header.grid_min_y;
+    tables.grid_start = reinterpret_cast<const int32_t *>(file.data() + header.grid_offset);
+    tables.grid_items = tables.grid_start + cells + 1;
+
+    // attaching releases the previous tables, the new ones live in the local mapping until the swap
+    if (!attachTables(tables))
+        return false;
+    file_.swap(file);
+
+    buildReferenceLine();
+    return true;
+}
+
+bool HighwayMap::attach(const MapTables &tables) {
+
+    if (!attachTables(tables))
+        return false;
+
+    buildReferenceLine();
+    return true;
+}
+
+MapTables HighwayMap::tables() const {
+
+    MapTables tables;
+    tables.waypoints = size();
+    tables.tables = kTables;
+    tables.table_block = x_.data();
+    tables.grid_cols = grid_.cols();
+    tables.grid_rows = grid_.rows();
+    tables.grid_cell = grid_.cellSize();
+    tables.grid_min_x = grid_.minX();
+    tables.grid_min_y = grid_.minY();
+    tables.grid_start = grid_.start().data();
+    tables.grid_items = grid_.items().data();
+    return tables;
+}
+
+bool HighwayMap::save(const string &map_file) const {
+
+    if (empty())
+        return false;
+
+    MapTables tables = this->tables();
+    uint64_t n = tables.waypoints;
+    uint64_t cells = uint64_t(tables.grid_cols) * tables.grid_rows;
+
+    MapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMapFileMagic, sizeof(kMapFileMagic));
+    header.version = kMapFileVersion;
+    header.byte_order = kMapFileByteOrder;
+    header.waypoints = n;
+    header.tables = tables.tables;
+    header.grid_cols = tables.grid_cols;
+    header.grid_rows = tables.grid_rows;
+    header.grid_cell = tables.grid_cell;
+    header.grid_min_x = tables.grid_min_x;
+    header.grid_min_y = tables.grid_min_y;
+    header.tables_offset = (sizeof(header) + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+    header.grid_offset = header.tables_offset + kTables * n * sizeof(double);
+    header.file_size = header.grid_offset + (cells + 1 + n) * sizeof(int32_t);
+
+    // the tables may be mapped from map_file itself, which is replaced rather than rewritten
+    vector<char> padding(header.tables_offset - sizeof(header), 0);
+    vector<FileChunk> chunks = {
+            {&header, sizeof(header)},
+            {padding.data(), padding.size()},
+            {tables.table_block, kTables * n * sizeof(double)},
+            {tables.grid_start, (cells + 1) * sizeof(int32_t)},
+            {tables.grid_items, n * sizeof(int32_t)}};
+    return replaceFile(map_file, chunks);
+}
+
+bool HighwayMap::attachTables(const MapTables &tables) {
+
+    int n = tables.waypoints;
+    int cells = tables.grid_cols * tables.grid_rows;
+    if (tables.tables != kTables || n <= 0 || cells <= 0 || tables.grid_start[0] != 0 || tables.grid_start[cells] != n)
+        return false;
+
+    attachTables(tables.table_block, n);
+    closed_ = true;
+    grid_.attach(tables.grid_cols, tables.grid_rows, tables.grid_cell, tables.grid_min_x, tables.grid_min_y,
+                 tables.grid_start, tables.grid_items, n);
+    file_.close();
+    vector<double>().swap(tables_);
+    return true;
+}
+
+void HighwayMap::attachTables(const double *block, int n) {
+
+    TableView<double> *tables[kTables] = {&x_, &y_, &s_, &dx_, &dy_, &cum_s_, &seg_len_,
+                                          &seg_cos_, &seg_sin_, &seg_nx_, &seg_ny_};
+    for (int k = 0; k < kTables; k++)
+        *tables[k] = TableView<double>(block + k * n, n);
+}
+
+void HighwayMap::build(const vector<double> &x, const vector<double> &y, const vector<double> &s,
+                       const vector<double> &dx, const vector<double> &dy, bool closed) {
+
+    int n = 1;
+    while (n < (int) s.size() && s[n] > s[n - 1])
+        n++;
+    n = min(n, int(s.size()));
+
+    vector<double> tables(kTables * n, 0.0);
+    double *map_x = &tables[kX * n];
+    double *map_y = &tables[kY * n];
+    double *cum_s = &tables[kCumS * n];
+    double *seg_len = &tables[kSegLen * n];
+    double *seg_cos = &tables[kSegCos * n];
+    double *seg_sin = &tables[kSegSin * n];
+    double *seg_nx = &tables[kSegNx * n];
+    double *seg_ny = &tables[kSegNy * n];
+
+    copy(x.begin(), x.begin() + n, map_x);
+    copy(y.begin(), y.begin() + n, map_y);
+    copy(s.begin(), s.begin() + n, &tables[kS * n]);
+    copy(dx.begin(), dx.begin() + n, &tables[kDx * n]);
+    copy(dy.begin(), dy.begin() + n, &tables[kDy * n]);
+
+    // segment i goes from waypoint i to waypoint i+1, the last one wraps around to waypoint 0. On an open
+    // polyline the last one has no length and continues the one before it past the last waypoint.
+    for (int i = 0; i < n; i++) {
+        int next = (i + 1) % n;
+        double len = distance(map_x[i], map_y[i], map_x[next], map_y[next]);
+        if (!closed && i == n - 1 && i > 0) {
+            seg_len[i] = 0.0;
+            seg_cos[i] = seg_cos[i - 1];
+            seg_sin[i] = seg_sin[i - 1];
+            seg_nx[i] = seg_nx[i - 1];
+            seg_ny[i] = seg_ny[i - 1];
+            cum_s[i] = cum_s[i - 1] + seg_len[i - 1];
+            continue;
+        }
+
+        seg_len[i] = len;
+        seg_cos[i] = 1.0;
+        seg_sin[i] = 0.0;
+        if (len > 0) {
+            seg_cos[i] = (map_x[next] - map_x[i]) / len;
+            seg_sin[i] = (map_y[next] - map_y[i]) / len;
+        }
+
+        // d grows to the right of the direction of travel, i.e. along heading - pi/2
+        seg_nx[i] = seg_sin[i];
+        seg_ny[i] = -seg_cos[i];
+
+        if (i > 0)
+            cum_s[i] = cum_s[i - 1] + seg_len[i - 1];
+    }
+
+    tables_.swap(tables);
+    attachTables(tables_.data(), n);
+    file_.close();
+    closed_ = closed;
+
+    grid_.build(map_x, map_y, n);
+
+    buildReferenceLine();
+}
+
+void HighwayMap::buildReferenceLine() {
+
+    spline_ = ReferenceSpline();
+    if (use_spline_)
+        spline_.fit(x_.data(), y_.data(), s_.data(), size());
+
+    resample(sample_ds_);
+}
+
+bool HighwayMap::fitSpline() {
+
+    use_spline_ = true;
+    bool fitted = spline_.fit(x_.data(), y_.data(), s_.data(), size());
+
+    resample(sample_ds_);
+    return fitted;
+}
+
+int HighwayMap::ClosestWaypoint(double x, double y) const {
+    return max(grid_.nearest(x, y, x_.data(), y_.data()), 0);
+}
+
+int HighwayMap::NextWaypoint(double x, double y, double theta) const {
+    return nextFromClosest(ClosestWaypoint(x, y), x, y, theta);
+}
+
+int HighwayMap::LocalClosestWaypoint(double x, double y, int hint, int max_steps) const {
+
+    int n = size();
+    int i = ((hint % n) + n) % n;
+    double best = distance(x, y, x_[i], y_[i]);
+
+    // walk downhill along the waypoints until neither neighbour is closer, an open polyline ends at both ends
+    for (int step = 0; ; step++) {
+        int prev = closed_ || i > 0 ? (i + n - 1) % n : i;
+        int next = closed_ || i < n - 1 ? (i + 1) % n : i;
+        double dist_prev = distance(x, y, x_[prev], y_[prev]);
+        double dist_next = distance(x, y, x_[next], y_[next]);
+
+        int move = -1;
+        double dist_move = best;
+        if (dist_prev < best || (dist_prev == best && prev < i)) { // same tie break as ClosestWaypoint
+            move = prev;
+            dist_move = dist_prev;
+        }
+        if (dist_next < dist_move) {
+            move = next;
+            dist_move = dist_next;
+        }
+
+        if (move < 0) {
+            // a local minimum further away than the adjacent segments may not be the global one
+            if (best > max(seg_len_[i], seg_len_[prev]))
+                return -1;
+            return i;
+        }
+        if (step == max_steps)
+            return -1;
+        i = move;
+        best = dist_move;
+    }
+}
+
+int HighwayMap::nextFromClosest(int closestWaypoint, double x, double y, double theta) const {
+
+    double map_x = x_[closestWaypoint];
+    double map_y = y_[closestWaypoint];
+
+    double heading = atan2((map_y - y), (map_x - x)); // atan2 in [-PI, PI], where wp is w.r.t. car
+
+    double angle = fabs(theta - heading); // difference in car yaw and heading
+
+    if (angle > M_PI / 4) // if point is not in car's line of sight, consider it behind
+        closestWaypoint = closed_ ? (closestWaypoint + 1) % size() : min(closestWaypoint + 1, size() - 1);
+
+    return closestWaypoint;
+}
+
+vector<double> HighwayMap::getFrenet(double x, double y, double theta) const {
+
+    if (sample_ds_ > 0) {
+        double s, d;
+        int seg = sampleSegment(x, y, sampleIndex(s_[ClosestWaypoint(x, y)]));
+        sampledFrenet(&x, &y, &seg, 1, &s, &d);
+        return {s, d};
+    }
+
+    if (splineFitted()) {
+        double s, d;
+        splineFrenet(x, y, theta, s, d);
+        return {s, d};
+    }
+
+    return frenetFromNext(NextWaypoint(x, y, theta), x, y);
+}
+
+void HighwayMap::splineFrenet(double x, double y, double theta, double &s, double &d) const {
+
+    // start the Newton steps at the closest waypoint, use the segments if they do not converge
+    int closest = ClosestWaypoint(x, y);
+    if (!spline_.getFrenet(x, y, s_[closest], s, d)) {
+        vector<double> sd = frenetFromNext(nextFromClosest(closest, x, y, theta), x, y);
+        s = sd[0];
+        d = sd[1];
+    }
+}
+
+int HighwayMap::sampleIndex(double s) const {
+    int last = int(sample_x_.size()) - 2;
+    return max(0, min(int((s - sample_s0_) * sample_inv_ds_), last));
+}
+
+int HighwayMap::sampleSegment(double x, double y, int k, int max_walk) const {
+
+    // (x, y) is past the normal at sample j if it is ahead of it along the tangent there
+    auto past = [&](int j) {
+        return (x - sample_x_[j]) * -sample_ny_[j] + (y - sample_y_[j]) * sample_nx_[j] >= 0;
+    };
+
+    int last = int(sample_x_.size()) - 2;
+    k = max(0, min(k, last));
+    int steps = 0;
+    while (k > 0 && !past(k)) {
+        k--;
+        if (max_walk >= 0 && ++steps > max_walk)
+            return -1;
+    }
+    while (k < last && past(k + 1)) {
+        k++;
+        if (max_walk >= 0 && ++steps > max_walk)
+            return -1;
+    }
+    return k;
+}
+
+void HighwayMap::sampledFrenet(const double *x, const double *y, const int *seg, int n, double *s, double *d) const {
+    sampledFrenetKernel(x, y, seg, n, sample_s0_, sample_ds_, sample_x_.data(), sample_y_.data(), sample_nx_.data(),
+                        sample_ny_.data(), s, d);
+}
+
+int HighwayMap::segmentBefore(int next_wp) const {
+    // before the first waypoint of an open polyline the first segment continues backwards
+    if (next_wp == 0)
+        return closed_ ? size() - 1 : 0;
+    return next_wp - 1;
+}
+
+vector<double> HighwayMap::frenetFromNext(int next_wp, double x, double y) const {
+
+    int prev_wp = segmentBefore(next_wp);
+
+    double x_x = x - x_[prev_wp];
+    double x_y = y - y_[prev_wp];
+
+    // the projection of x onto the segment gives s, the offset along its normal gives d. Only before the
+    // start of an open polyline is the projection negative.
+    double along = x_x * seg_cos_[prev_wp] + x_y * seg_sin_[prev_wp];
+    double frenet_s = frenetS()[prev_wp] + (closed_ || prev_wp > 0 ? fabs(along) : along);
+    double frenet_d = x_x * seg_nx_[prev_wp] + x_y * seg_ny_[prev_wp];
+
+    return {frenet_s, frenet_d};
+}
+
+vector<double> HighwayMap::getXY(double s, double d) const {
+
+    double x, y;
+    if (sample_ds_ > 0) {
+        sampledXY(s, d, sample_s0_, sample_inv_ds_, sample_x_.size(), sample_x_.data(), sample_y_.data(),
+                  sample_nx_.data(), sample_ny_.data(), x, y);
+        return {x, y};
+    }
+
+    if (splineFitted()) {
+        spline_.getXY(s, d, x, y);
+        return {x, y};
+    }
+
+    return polylineXY(s, d);
+}
+
+vector<double> HighwayMap::polylineXY(double s, double d) const {
+
+    int prev_wp = segmentAt(s, -1);
+
+    // the x,y,s along the segment
+    double seg_s = (s - s_[prev_wp]);
+
+    double x = x_[prev_wp] + seg_s * seg_cos_[prev_wp] + d * seg_nx_[prev_wp];
+    double y = y_[prev_wp] + seg_s * seg_sin_[prev_wp] + d * seg_ny_[prev_wp];
+
+    return {x, y};
+}
+
+int HighwayMap::segmentAt(double s, int hint) const {
+
+    // last waypoint whose s is strictly smaller than the given s, or the first one
+    int n = size();
+    if (hint >= 0 && hint < n && s_[hint] < s && (hint + 1 == n || s <= s_[hint + 1]))
+        return hint;
+
+    int prev_wp = int(lower_bound(s_.begin(), s_.end(), s) - s_.begin()) - 1;
+    return max(prev_wp, 0);
+}
+
+void HighwayMap::getFrenetBatch(const double *x, const double *y, const double *theta, int n, double *s, double *d) const {
+
+    // the first point uses the global index, every other one starts from the previous one
+    FrenetCursor cursor(*this);
+    cursor.getFrenetBatch(x, y, theta, n, s, d);
+}
+
+void HighwayMap::getXYBatch(const double *s, const double *d, int n, double *x, double *y) const {
+
+    if (sample_ds_ > 0) {
+        sampledXYKernel(s, d, n, sample_s0_, sample_inv_ds_, sample_x_.size(), sample_x_.data(), sample_y_.data(),
+                        sample_nx_.data(), sample_ny_.data(), x, y);
+        return;
+    }
+
+    if (splineFitted()) {
+        for (int i = 0; i < n; i++)
+            spline_.getXY(s[i], d[i], x[i], y[i]);
+        return;
+    }
+
+    int seg[kBatchChunk];
+    int prev_wp = -1;
+
+    for (int start = 0; start < n; start += kBatchChunk) {
+        int count = min(kBatchChunk, n - start);
+
+        for (int i = 0; i < count; i++) {
+            prev_wp = segmentAt(s[start + i], prev_wp);
+            seg[i] = prev_wp;
+        }
+
+        xyKernel(s + start, d + start, seg, count, x_.data(), y_.data(), s_.data(),
+                 seg_cos_.data(), seg_sin_.data(), seg_nx_.data(), seg_ny_.data(), x + start, y + start);
+    }
+}
+
+void HighwayMap::resample(double ds) {
+
+    vector<double>().swap(sample_x_);
+    vector<double>().swap(sample_y_);
+    vector<double>().swap(sample_nx_);
+    vector<double>().swap(sample_ny_);
+    sample_ds_ = 0.0;
+    if (ds <= 0 || empty())
+        return;
+
+    // cover the waypoints and the closing segment back to the first one, which getXY() also follows.
+    // The spline ends at the last waypoint and continues straight, like the samples past the end.
+    double s_end = splineFitted() ? spline_.endS() : s_.back() + seg_len_.back();
+    int samples = max(2, int(ceil((s_end - s_.front()) / ds)) + 1);
+
+    vector<double>(samples).swap(sample_x_);
+    vector<double>(samples).swap(sample_y_);
+    vector<double>(samples).swap(sample_nx_);
+    vector<double>(samples).swap(sample_ny_);
+
+    int prev_wp = -1;
+    for (int k = 0; k < samples; k++) {
+        double s = s_.front() + k * ds;
+
+        if (splineFitted()) {
+            double cos_h, sin_h;
+            spline_.evaluate(s, sample_x_[k], sample_y_[k], cos_h, sin_h);
+            sample_nx_[k] = sin_h;
+            sample_ny_[k] = -cos_h;
+            continue;
+        }
+
+        prev_wp = segmentAt(s, prev_wp);
+        double seg_s = s - s_[prev_wp];
+        sample_x_[k] = x_[prev_wp] + seg_s * seg_cos_[prev_wp];
+        sample_y_[k] = y_[prev_wp] + seg_s * seg_sin_[prev_wp];
+        sample_nx_[k] = seg_nx_[prev_wp];
+        sample_ny_[k] = seg_ny_[prev_wp];
+    }
+
+    sample_s0_ = s_.front();
+    sample_ds_ = ds;
+    sample_inv_ds_ = 1.0 / ds;
+}
+
+HighwayMap::ResampleStats HighwayMap::resampleStats() const {
+
+    ResampleStats stats = {sample_ds_, int(sample_x_.size()), 0, 0.0, 0.0};
+    stats.bytes = sizeof(double) * (sample_x_.capacity() + sample_y_.capacity() + sample_nx_.capacity() +
+                                    sample_ny_.capacity());
+    if (sample_ds_ <= 0)
+        return stats;
+
+    // compare against the waypoint segments at random points of the reference line. Off the line
+    // the segments jump by d times the heading change at every waypoint, which the samples smooth out.
+    mt19937 gen(1);
+    uniform_real_distribution<double> s_dist(s_.front(), s_.back());
+    const int checks = 20000;
+    double sum_sq = 0.0;
+    for (int i = 0; i < checks; i++) {
+        double s = s_dist(gen);
+        vector<double> sampled = getXY(s, 0.0);
+        vector<double> exact(2);
+        if (splineFitted())
+            spline_.getXY(s, 0.0, exact[0], exact[1]);
+        else
+            exact = polylineXY(s, 0.0);
+        double err = distance(sampled[0], sampled[1], exact[0], exact[1]);
+        stats.max_error = max(stats.max_error, err);
+        sum_sq += err * err;
+    }
+    stats.rms_error = sqrt(sum_sq / checks);
+
+    return stats;
+}
+
+FrenetCursor::FrenetCursor(const HighwayMap &map, int max_walk): map_(&map), hint_(-1), max_walk_(max_walk),
+    global_queries_(0), last_s_(0.0) {}
+
+vector<double> FrenetCursor::getFrenet(double x, double y, double theta) {
+
+    if (map_->sampleSpacing() > 0) {
+        double s, d;
+        getFrenetBatch(&x, &y, &theta, 1, &s, &d);
+        return {s, d};
+    }
+
+    if (map_->splineFitted()) {
+        double s, d;
+        if (hint_ < 0 || !map_->spline_.getFrenet(x, y, last_s_, s, d)) {
+            map_->splineFrenet(x, y, theta, s, d);
+            global_queries_++;
+        }
+        hint_ = 0; // only marks last_s_ as valid
+        last_s_ = s;
+        return {s, d};
+    }
+
+    int closest = -1;
+    if (hint_ >= 0)
+        closest = map_->LocalClosestWaypoint(x, y, hint_, max_walk_);
+
+    if (closest < 0) {
+        closest = map_->ClosestWaypoint(x, y);
+        global_queries_++;
+    }
+    hint_ = closest;
+
+    return map_->frenetFromNext(map_->nextFromClosest(closest, x, y, theta), x, y);
+}
+
+void FrenetCursor::getFrenetBatch(const double *x, const double *y, const double *theta, int n, double *s, double *d) {
+
+    const HighwayMap &map = *map_;
+    int seg[kBatchChunk];
+
+    if (map.sampleSpacing() > 0) {
+        // the segments between the samples are found walking from the previous one, the hint
+        for (int start = 0; start < n; start += kBatchChunk) {
+            int count = min(kBatchChunk, n - start);
+            for (int i = 0; i < count; i++) {
+                double px = x[start + i], py = y[start + i];
+                int k = hint_ >= 0 ? map.sampleSegment(px, py, hint_, max_walk_) : -1;
+                if (k < 0) {
+                    k = map.sampleSegment(px, py, map.sampleIndex(map.s_[map.ClosestWaypoint(px, py)]));
+                    global_queries_++;
+                }
+                hint_ = k;
+                seg[i] = k;
+            }
+            map.sampledFrenet(x + start, y + start, seg, count, s + start, d + start);
+        }
+        return;
+    }
+
+    if (map.splineFitted()) {
+        // each point starts its Newton steps from the s of the previous one
+        for (int i = 0; i < n; i++) {
+            if (hint_ < 0 || !map.spline_.getFrenet(x[i], y[i], last_s_, s[i], d[i])) {
+                map.splineFrenet(x[i], y[i], theta[i], s[i], d[i]);
+                global_queries_++;
+            }
+            hint_ = 0;
+            last_s_ = s[i];
+        }
+        return;
+    }
+
+    for (int start = 0; start < n; start += kBatchChunk) {
+        int count = min(kBatchChunk, n - start);
+
+        for (int i = 0; i < count; i++) {
+            double px = x[start + i], py = y[start + i];
+            int closest = -1;
+            if (hint_ >= 0)
+                closest = map.LocalClosestWaypoint(px, py, hint_, max_walk_);
+            if (closest < 0) {
+                closest = map.ClosestWaypoint(px, py);
+                global_queries_++;
+            }
+            hint_ = closest;
+
+            int next_wp = map.nextFromClosest(closest, px, py, theta[start + i]);
+            seg[i] = map.segmentBefore(next_wp);
+        }
+
+        frenetKernel(x + start, y + start, seg, count, map.x_.data(), map.y_.data(), map.frenetS().data(),
+                     map.seg_cos_.data(), map.seg_sin_.data(), map.seg_nx_.data(), map.seg_ny_.data(), map.closed_,
+                     s + start, d + start);
+    }
+}
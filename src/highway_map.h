@@ -0,0 +1,196 @@
+#ifndef HIGHWAY_MAP_H
+#define HIGHWAY_MAP_H
+
+#include <string>
+#include <vector>
+
+#include "map_file.h"
+#include "reference_spline.h"
+#include "table_view.h"
+#include "waypoint_grid.h"
+
+// Waypoint map of the highway, loaded once at startup.
+//
+// Waypoints are stored as structure-of-arrays together with tables derived from
+// them, so Frenet <-> Cartesian conversions never walk or copy the whole map. All
+// tables share one block, built in memory from a CSV file or mapped from a file
+// written by tools/map_compiler (see map_file.h):
+//   cum_s_[i]            arc length of the waypoint polyline up to waypoint i
+//   seg_len_[i]          length of segment i -> (i+1) % size()
+//   seg_cos_[i], _sin_   heading of segment i
+//   seg_nx_[i], _ny_     unit normal of segment i, pointing towards positive d
+//   grid_                spatial index for nearest-waypoint queries
+//
+// Optionally the waypoints are interpolated by a smooth spline_, which getFrenet() and getXY()
+// then follow instead of the straight segments. The reference line can also be resampled every
+// sample_ds_ meters, getXY() then interpolates between the two samples around s instead of
+// searching for the segment or evaluating the spline, and getFrenet() inverts that interpolation,
+// for batches in one vectorized pass.
+class HighwayMap {
+public:
+    // Memory used by the resampled reference line and its position error against the waypoint polyline
+    struct ResampleStats {
+        double ds;
+        int samples;
+        size_t bytes;
+        double max_error;
+        double rms_error;
+    };
+
+    HighwayMap(): closed_(true), use_spline_(false), sample_s0_(0.0), sample_ds_(0.0), sample_inv_ds_(0.0) {}
+
+    // Load a compiled map file, or read waypoints (x y s dx dy per line) from a CSV map file.
+    // Returns false if the file is not valid or no waypoint could be read.
+    bool load(const std::string &map_file);
+
+    // Write the waypoints and derived tables as a compiled map file
+    bool save(const std::string &map_file) const;
+
+    // Use tables that outlive the map, e.g. the ones compiled into the executable. Returns false
+    // if they do not have the layout of this version.
+    bool attach(const MapTables &tables);
+
+    // Where the waypoints and derived tables are stored
+    MapTables tables() const;
+
+    // Build the derived tables for the given waypoints. Only the leading run of waypoints with
+    // increasing s is kept, the Bosch map file repeats its 133 waypoints 19 times. A closed map is a
+    // loop whose last segment goes back to the first waypoint, an open one continues straight past
+    // both ends, e.g. a piece of a longer route, and its getFrenet() s follows the given s instead of
+    // starting at 0. Loaded maps are closed.
+    void build(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &s,
+               const std::vector<double> &dx, const std::vector<double> &dy, bool closed = true);
+
+    int size() const { return x_.size(); }
+    bool empty() const { return x_.empty(); }
+    bool closed() const { return closed_; }
+
+    const TableView<double> &x() const { return x_; }
+    const TableView<double> &y() const { return y_; }
+    const TableView<double> &s() const { return s_; }
+    const TableView<double> &dx() const { return dx_; }
+    const TableView<double> &dy() const { return dy_; }
+
+    // True if the tables are mapped from a compiled map file
+    bool mapped() const { return file_.data() != nullptr; }
+
+    int ClosestWaypoint(double x, double y) const;
+    int NextWaypoint(double x, double y, double theta) const;
+
+    // Closest waypoint found by walking along the map from the waypoint hint,
+    // -1 if it is not reached within max_steps or the walk ends far away from the road
+    int LocalClosestWaypoint(double x, double y, int hint, int max_steps) const;
+
+    // Transform from Cartesian x,y coordinates to Frenet s,d coordinates
+    std::vector<double> getFrenet(double x, double y, double theta) const;
+
+    // Transform from Frenet s,d coordinates to Cartesian x,y
+    std::vector<double> getXY(double s, double d) const;
+
+    // Interpolate the waypoints with a smooth spline, returns false if it could not be fitted
+    bool fitSpline();
+    bool splineFitted() const { return !spline_.empty(); }
+    const ReferenceSpline &spline() const { return spline_; }
+
+    // Resample the reference line every ds meters, ds <= 0 goes back to the waypoint segments
+    void resample(double ds);
+    double sampleSpacing() const { return sample_ds_; }
+    ResampleStats resampleStats() const;
+
+    // Batch versions of getFrenet() and getXY() over n points, same results as the single point ones.
+    // Segments are looked up point by point starting from the previous one, then the projections
+    // run as one vectorized pass over the arrays.
+    void getFrenetBatch(const double *x, const double *y, const double *theta, int n, double *s, double *d) const;
+    void getXYBatch(const double *s, const double *d, int n, double *x, double *y) const;
+
+private:
+    friend class FrenetCursor;
+
+    // order of the per-waypoint tables in their block
+    enum { kX, kY, kS, kDx, kDy, kCumS, kSegLen, kSegCos, kSegSin, kSegNx, kSegNy, kTables };
+
+    HighwayMap(const HighwayMap &);
+    HighwayMap &operator=(const HighwayMap &);
+
+    bool readCSV(const std::string &map_file);
+    bool mapCompiled(const std::string &map_file);
+    bool attachTables(const MapTables &tables);
+    void attachTables(const double *block, int n);
+    void buildReferenceLine();
+
+    // s of the waypoints as getFrenet() reports it, the polyline length on a loop and the waypoints' own s on an
+    // open piece of a longer route, so its s continues the route's like getXY() expects
+    const TableView<double> &frenetS() const { return closed_ ? cum_s_ : s_; }
+
+    int nextFromClosest(int closestWaypoint, double x, double y, double theta) const;
+    int segmentBefore(int next_wp) const;
+    std::vector<double> frenetFromNext(int next_wp, double x, double y) const;
+    int segmentAt(double s, int hint) const;
+    std::vector<double> polylineXY(double s, double d) const;
+    void splineFrenet(double x, double y, double theta, double &s, double &d) const;
+
+    // sample segment at s, the one whose normals at both ends enclose (x, y) walking from segment k (-1 if that
+    // takes more than max_walk steps, unless max_walk is negative), and the s,d of points on the given segments of
+    // the resampled line
+    int sampleIndex(double s) const;
+    int sampleSegment(double x, double y, int k, int max_walk = -1) const;
+    void sampledFrenet(const double *x, const double *y, const int *seg, int n, double *s, double *d) const;
+
+    // storage of the tables, unless they are mapped from file_
+    std::vector<double> tables_;
+    MappedFile file_;
+
+    // raw waypoints
+    TableView<double> x_, y_, s_, dx_, dy_;
+
+    // derived tables, one entry per waypoint
+    TableView<double> cum_s_;
+    TableView<double> seg_len_;
+    TableView<double> seg_cos_, seg_sin_;
+    TableView<double> seg_nx_, seg_ny_;
+
+    WaypointGrid grid_;
+
+    bool closed_;
+    bool use_spline_;
+    ReferenceSpline spline_;
+
+    // resampled reference line, sample k is at s = sample_s0_ + k * sample_ds_
+    double sample_s0_, sample_ds_, sample_inv_ds_;
+    std::vector<double> sample_x_, sample_y_;
+    std::vector<double> sample_nx_, sample_ny_;
+};
+
+// Frenet conversion for a sequence of nearby points, such as the points of a trajectory
+// or the ego car from one telemetry frame to the next.
+//
+// The cursor remembers the closest waypoint of the previous query and walks from there,
+// which is O(1) when consecutive points are close. It falls back to the map's global
+// index for the first query and whenever the walk takes more than max_walk steps.
+// On a map with a fitted spline the Newton steps start from the previous s instead, and on a
+// resampled one the walk goes along the samples, up to max_walk of them.
+// A cursor is cheap to copy, e.g. to continue several trajectories from the end of a shared prefix.
+class FrenetCursor {
+public:
+    explicit FrenetCursor(const HighwayMap &map, int max_walk = 8);
+
+    // Same result as HighwayMap::getFrenet()
+    std::vector<double> getFrenet(double x, double y, double theta);
+
+    // Same results as HighwayMap::getFrenetBatch(), the first point starts from the last query
+    void getFrenetBatch(const double *x, const double *y, const double *theta, int n, double *s, double *d);
+
+    // Forget the hint, the next query uses the global index
+    void reset() { hint_ = -1; }
+
+    int globalQueries() const { return global_queries_; }
+
+private:
+    const HighwayMap *map_;
+    int hint_;
+    int max_walk_;
+    int global_queries_;
+    double last_s_;
+};
+
+#endif /* HIGHWAY_MAP_H */
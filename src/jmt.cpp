@@ -0,0 +1,82 @@
+#include "jmt.h"
+
+#include <algorithm>
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+
+using namespace std;
+
+double Quintic::deriv(double t, int order) const {
+    switch (order) {
+    case 1:
+        return c[1] + t * (2 * c[2] + t * (3 * c[3] + t * (4 * c[4] + t * 5 * c[5])));
+    case 2:
+        return 2 * c[2] + t * (6 * c[3] + t * (12 * c[4] + t * 20 * c[5]));
+    case 3:
+        return 6 * c[3] + t * (24 * c[4] + t * 60 * c[5]);
+    default:
+        return 0.0;
+    }
+}
+
+Quintic solveJMT(const JMTState &start, const JMTState &end, double T) {
+    Quintic q;
+    solveJMTBatch(start, &end, 1, T, &q);
+    return q;
+}
+
+void solveJMTBatch(const JMTState &start, const JMTState *end, int n, double T, Quintic *out) {
+
+    // the first three coefficients are the start state, the other three satisfy the end state
+    double T2 = T * T, T3 = T2 * T, T4 = T3 * T, T5 = T4 * T;
+    Eigen::Matrix3d A;
+    A << T3, T4, T5,
+         3 * T2, 4 * T3, 5 * T4,
+         6 * T, 12 * T2, 20 * T3;
+    Eigen::PartialPivLU<Eigen::Matrix3d> lu(A);
+
+    // the end states one per column, in blocks so the right hand side stays on the stack
+    const int block = 64;
+    Eigen::Matrix<double, 3, block> rhs;
+    Eigen::Matrix<double, 3, block> coeffs;
+    for (int first = 0; first < n; first += block) {
+        int m = min(block, n - first);
+        for (int k = 0; k < m; k++) {
+            const JMTState &e = end[first + k];
+            rhs(0, k) = e.p - (start.p + start.v * T + 0.5 * start.a * T2);
+            rhs(1, k) = e.v - (start.v + start.a * T);
+            rhs(2, k) = e.a - start.a;
+        }
+        coeffs.leftCols(m) = lu.solve(rhs.leftCols(m));
+
+        for (int k = 0; k < m; k++) {
+            Quintic &q = out[first + k];
+            q.c[0] = start.p;
+            q.c[1] = start.v;
+            q.c[2] = 0.5 * start.a;
+            q.c[3] = coeffs(0, k);
+            q.c[4] = coeffs(1, k);
+            q.c[5] = coeffs(2, k);
+        }
+    }
+}
+
+void sampleJMT(const Quintic &q, double T, double t0, double dt, int n, double *p, double *v, double *a, double *j) {
+
+    double p_end = q(T), v_end = q.deriv(T, 1);
+    for (int k = 0; k < n; k++) {
+        double t = t0 + k * dt;
+        if (t <= T) {
+            p[k] = q(t);
+            v[k] = q.deriv(t, 1);
+            a[k] = q.deriv(t, 2);
+            j[k] = q.deriv(t, 3);
+        } else {
+            p[k] = p_end + v_end * (t - T);
+            v[k] = v_end;
+            a[k] = 0.0;
+            j[k] = 0.0;
+        }
+    }
+}
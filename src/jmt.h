@@ -0,0 +1,33 @@
+#ifndef JMT_H
+#define JMT_H
+
+// Jerk-minimizing trajectories: the quintic p(t) = c[0] + c[1] t + ... + c[5] t^5 that moves from a
+// start state to an end state (position, velocity, acceleration) in time T with the least
+// integrated squared jerk. Velocity, acceleration and jerk come straight from the coefficients.
+struct Quintic {
+    double c[6];
+
+    double operator()(double t) const {
+        return c[0] + t * (c[1] + t * (c[2] + t * (c[3] + t * (c[4] + t * c[5]))));
+    }
+
+    // first, second or third derivative at t
+    double deriv(double t, int order) const;
+};
+
+// Position, velocity and acceleration along one axis
+struct JMTState {
+    double p, v, a;
+};
+
+Quintic solveJMT(const JMTState &start, const JMTState &end, double T);
+
+// One quintic per end state, all from the same start in the same time T. The 3x3 system only
+// depends on T, so it is factorized once and all end states are solved together.
+void solveJMTBatch(const JMTState &start, const JMTState *end, int n, double T, Quintic *out);
+
+// Samples p, v, a and jerk of a quintic at t = t0 + k dt, k = 0..n-1. Past T the motion goes on
+// with the end velocity, like a vehicle that holds its speed once the maneuver is done.
+void sampleJMT(const Quintic &q, double T, double t0, double dt, int n, double *p, double *v, double *a, double *j);
+
+#endif /* JMT_H */
@@ -0,0 +1,230 @@
+#include "lattice_planner.h"
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// x86-64 builds with GCC get an AVX2 clone of the cost kernels next to the generic one,
+// the loader picks the one the CPU supports
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define LATTICE_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define LATTICE_KERNEL
+#endif
+
+// p, v, a and jerk at t of n quintics with their coefficients in one array each
+LATTICE_KERNEL
+void quinticKernel(const double *__restrict c0, const double *__restrict c1, const double *__restrict c2,
+                   const double *__restrict c3, const double *__restrict c4, const double *__restrict c5, double t, int n,
+                   double *__restrict p, double *__restrict v, double *__restrict a, double *__restrict j) {
+    for (int i = 0; i < n; i++) {
+        p[i] = c0[i] + t * (c1[i] + t * (c2[i] + t * (c3[i] + t * (c4[i] + t * c5[i]))));
+        v[i] = c1[i] + t * (2 * c2[i] + t * (3 * c3[i] + t * (4 * c4[i] + t * 5 * c5[i])));
+        a[i] = 2 * c2[i] + t * (6 * c3[i] + t * (12 * c4[i] + t * 20 * c5[i]));
+        j[i] = 6 * c3[i] + t * (24 * c4[i] + t * 60 * c5[i]);
+    }
+}
+
+// the same quintics dt past their end, holding their end speed
+LATTICE_KERNEL
+void holdKernel(const double *__restrict p_end, const double *__restrict v_end, double dt, int n,
+                double *__restrict p, double *__restrict v, double *__restrict a, double *__restrict j) {
+    for (int i = 0; i < n; i++) {
+        p[i] = p_end[i] + v_end[i] * dt;
+        v[i] = v_end[i];
+        a[i] = 0.0;
+        j[i] = 0.0;
+    }
+}
+
+// running maxima of the squared speed, acceleration and jerk magnitudes, s per candidate and d shared by all.
+// Squared so the loop has no sqrt, which is not vectorized where it may set errno.
+LATTICE_KERNEL
+void kinematicsKernel(const double *__restrict vs, const double *__restrict as, const double *__restrict js,
+                      double vd, double ad, double jd, int n,
+                      double *__restrict v2_max, double *__restrict a2_max, double *__restrict j2_max) {
+    for (int i = 0; i < n; i++) {
+        v2_max[i] = max(v2_max[i], vs[i] * vs[i] + vd * vd);
+        a2_max[i] = max(a2_max[i], as[i] * as[i] + ad * ad);
+        j2_max[i] = max(j2_max[i], js[i] * js[i] + jd * jd);
+    }
+}
+
+// penalty where s is within gap_behind ahead of or gap_ahead behind a car at car_s
+LATTICE_KERNEL
+void gapKernel(const double *__restrict s, double car_s, double gap_ahead, double gap_behind, double penalty, int n,
+               double *__restrict collision) {
+    for (int i = 0; i < n; i++) {
+        double gap = s[i] - car_s;
+        collision[i] = max(collision[i], gap > -gap_ahead && gap < gap_behind ? penalty : 0.0);
+    }
+}
+
+LATTICE_KERNEL
+void costKernel(const double *__restrict v_max, const double *__restrict a_max, const double *__restrict j_max,
+                const double *__restrict collision, const double *__restrict efficiency, double shared, int n,
+                double speed_limit, double accel_limit, double jerk_limit, double *__restrict cost) {
+    for (int i = 0; i < n; i++) {
+        double limits = (v_max[i] > speed_limit ? 10.0 : 0.0) + (a_max[i] > accel_limit ? 10.0 : 0.0) +
+                        (j_max[i] > jerk_limit ? 10.0 : 0.0);
+        double comfort = 0.1 * (a_max[i] / accel_limit + j_max[i] / jerk_limit);
+        cost[i] = shared + collision[i] + limits + efficiency[i] + comfort;
+    }
+}
+
+}
+
+int LatticeConfig::samples() const {
+    return int(round(max_duration / dt)) + 1;
+}
+
+LatticePlanner::LatticePlanner(const LatticeConfig &config): config_(config) {
+    config_.lanes = max(config_.lanes, 1);
+    config_.speeds = max(config_.speeds, 1);
+    config_.durations = max(config_.durations, 1);
+}
+
+double LatticePlanner::speed(int speed) const {
+    if (config_.speeds == 1)
+        return config_.max_speed;
+    return config_.min_speed + speed * (config_.max_speed - config_.min_speed) / (config_.speeds - 1);
+}
+
+double LatticePlanner::duration(int duration) const {
+    if (config_.durations == 1)
+        return config_.max_duration;
+    return config_.min_duration + duration * (config_.max_duration - config_.min_duration) / (config_.durations - 1);
+}
+
+void LatticePlanner::prepare(const JMTState &start_s, const JMTState &start_d, TickArena &arena,
+                             LatticeCandidates &candidates) const {
+
+    const int lanes = config_.lanes, speeds = config_.speeds, durations = config_.durations;
+
+    candidates.start_s = start_s;
+    candidates.start_d = start_d;
+    candidates.size = config_.candidates();
+    candidates.s_profiles = arena.allocate<Quintic>(durations * speeds);
+    candidates.d_profiles = arena.allocate<Quintic>(durations * lanes);
+    candidates.v_max = arena.allocate<double>(candidates.size);
+    candidates.a_max = arena.allocate<double>(candidates.size);
+    candidates.j_max = arena.allocate<double>(candidates.size);
+    candidates.cost = arena.allocate<double>(candidates.size);
+
+    // end states, like generateTrajectoriesJMT() the distance is the one at the mean of the two speeds
+    JMTState *end_s = arena.allocate<JMTState>(speeds);
+    JMTState *end_d = arena.allocate<JMTState>(lanes);
+    for (int l = 0; l < lanes; l++)
+        end_d[l] = {(l + 0.5) * config_.lane_width, 0.0, 0.0};
+
+    for (int m = 0; m < durations; m++) {
+        double T = duration(m);
+        for (int v = 0; v < speeds; v++)
+            end_s[v] = {start_s.p + T * (start_s.v + speed(v)) / 2, speed(v), 0.0};
+        solveJMTBatch(start_s, end_s, speeds, T, candidates.s_profiles + m * speeds);
+        solveJMTBatch(start_d, end_d, lanes, T, candidates.d_profiles + m * lanes);
+    }
+}
+
+void LatticePlanner::evaluate(int m, const LatticeTraffic &traffic, double time_offset, int goal_lane, TickArena &arena,
+                              LatticeCandidates &candidates) const {
+
+    const int lanes = config_.lanes, speeds = config_.speeds, samples = config_.samples();
+    const double T = duration(m), dt = config_.dt, w = config_.lane_width;
+
+    // coefficients of the s(t) of this duration, one array each
+    double *c[6];
+    for (int k = 0; k < 6; k++) {
+        c[k] = arena.allocate<double>(speeds);
+        for (int v = 0; v < speeds; v++)
+            c[k][v] = candidates.s_profiles[m * speeds + v].c[k];
+    }
+    double *p_end = arena.allocate<double>(speeds), *v_end = arena.allocate<double>(speeds);
+    for (int v = 0; v < speeds; v++) {
+        p_end[v] = candidates.s_profiles[m * speeds + v](T);
+        v_end[v] = candidates.s_profiles[m * speeds + v].deriv(T, 1);
+    }
+
+    // s(t) of every speed at every sample, one row of speeds per sample
+    double *sp = arena.allocate<double>(samples * speeds), *sv = arena.allocate<double>(samples * speeds);
+    double *sa = arena.allocate<double>(samples * speeds), *sj = arena.allocate<double>(samples * speeds);
+    for (int k = 0; k < samples; k++) {
+        double t = k * dt;
+        int row = k * speeds;
+        if (t <= T)
+            quinticKernel(c[0], c[1], c[2], c[3], c[4], c[5], t, speeds, sp + row, sv + row, sa + row, sj + row);
+        else
+            holdKernel(p_end, v_end, t - T, speeds, sp + row, sv + row, sa + row, sj + row);
+    }
+
+    double *efficiency = arena.allocate<double>(speeds);
+    for (int v = 0; v < speeds; v++)
+        efficiency[v] = abs(config_.speed_limit - speed(v)) / config_.speed_limit;
+
+    double *dp = arena.allocate<double>(samples), *dv = arena.allocate<double>(samples);
+    double *da = arena.allocate<double>(samples), *dj = arena.allocate<double>(samples);
+    double *collision = arena.allocate<double>(speeds);
+    double *v2_max = arena.allocate<double>(speeds), *a2_max = arena.allocate<double>(speeds), *j2_max = arena.allocate<double>(speeds);
+    int *car_lanes = arena.allocate<int>(traffic.size);
+    for (int i = 0; i < traffic.size; i++)
+        car_lanes[i] = int(floor(traffic.d[i] / w));
+
+    for (int l = 0; l < lanes; l++) {
+
+        sampleJMT(candidates.d_profiles[m * lanes + l], T, 0.0, dt, samples, dp, dv, da, dj);
+
+        int first = (m * lanes + l) * speeds;
+        double *v_max = candidates.v_max + first, *a_max = candidates.a_max + first, *j_max = candidates.j_max + first;
+        fill(collision, collision + speeds, 0.0);
+
+        bool off_road = false;
+        fill(v2_max, v2_max + speeds, 0.0);
+        fill(a2_max, a2_max + speeds, 0.0);
+        fill(j2_max, j2_max + speeds, 0.0);
+        for (int k = 0; k < samples; k++) {
+
+            int row = k * speeds;
+            kinematicsKernel(sv + row, sa + row, sj + row, dv[k], da[k], dj[k], speeds, v2_max, a2_max, j2_max);
+
+            // the ego is 2m wide, it is in every lane it overlaps
+            int lo = int(floor((dp[k] - 1.0) / w)), hi = int(floor((dp[k] + 1.0) / w));
+            off_road |= lo < 0 || hi >= lanes;
+
+            // a collision costs 10, and more the sooner it comes
+            double t = k * dt, penalty = 10.0 + double(samples - k) / samples;
+            for (int i = 0; i < traffic.size; i++)
+                if (car_lanes[i] >= lo && car_lanes[i] <= hi)
+                    gapKernel(sp + row, traffic.s[i] + traffic.v[i] * (time_offset + t), config_.gap_ahead,
+                              config_.gap_behind, penalty, speeds, collision);
+        }
+
+        for (int v = 0; v < speeds; v++) {
+            v_max[v] = sqrt(v2_max[v]);
+            a_max[v] = sqrt(a2_max[v]);
+            j_max[v] = sqrt(j2_max[v]);
+        }
+
+        double shared = (off_road ? 10.0 : 0.0) + abs(l - goal_lane) * config_.lane_change_cost;
+        costKernel(v_max, a_max, j_max, collision, efficiency, shared, speeds, config_.speed_limit, config_.accel_limit,
+                   config_.jerk_limit, candidates.cost + first);
+    }
+}
+
+void LatticePlanner::skip(int m, LatticeCandidates &candidates) const {
+    int first = m * config_.lanes * config_.speeds;
+    fill(candidates.cost + first, candidates.cost + first + config_.lanes * config_.speeds, numeric_limits<double>::infinity());
+}
+
+int LatticePlanner::best(const LatticeCandidates &candidates) const {
+    return int(min_element(candidates.cost, candidates.cost + candidates.size) - candidates.cost);
+}
+
+void LatticePlanner::split(int c, int &lane, int &speed, int &duration) const {
+    speed = c % config_.speeds;
+    lane = c / config_.speeds % config_.lanes;
+    duration = c / config_.speeds / config_.lanes;
+}
@@ -0,0 +1,86 @@
+#ifndef LATTICE_PLANNER_H
+#define LATTICE_PLANNER_H
+
+#include "jmt.h"
+#include "trajectory_buffer.h"
+
+// Maneuvers the lattice planner samples from the end of the previous path: every lateral target
+// (a lane center) x every target speed x every maneuver duration, each a quintic s(t) and d(t).
+struct LatticeConfig {
+    int lanes = 3;
+    double lane_width = 4.0;
+
+    // target speeds, evenly spaced, in m/s
+    int speeds = 24;
+    double min_speed = 0.0, max_speed = 21.9;
+
+    // maneuver durations, evenly spaced, in s
+    int durations = 13;
+    double min_duration = 1.0, max_duration = 4.0;
+
+    // candidates are checked every dt up to max_duration, past their duration they hold their speed
+    double dt = 0.1;
+
+    // a candidate over any of these limits, off the road or too close to a car costs 10 or more
+    double speed_limit = kSpeedLimit, accel_limit = kAccelLimit, jerk_limit = kJerkLimit;
+
+    // gap to a car in the same lane that counts as a collision, like calculateCost()
+    double gap_ahead = 20.0, gap_behind = 10.0;
+
+    // cost of each lane away from the goal lane, so the planner does not switch lanes for nothing
+    double lane_change_cost = 0.2;
+
+    int candidates() const { return lanes * speeds * durations; }
+    int samples() const;
+};
+
+// Other cars in one array per field, predicted at constant speed along s in their lane
+struct LatticeTraffic {
+    const double *s = nullptr, *v = nullptr, *d = nullptr;
+    int size = 0;
+};
+
+// The candidates of one frame, one array per field. Candidate c is
+// (duration * lanes + lane) * speeds + speed, so the candidates sharing a duration and a lane are
+// contiguous and their costs are computed in one vectorized pass over the speeds. All candidates of a
+// duration share their s(t) per speed and their d(t) per lane.
+struct LatticeCandidates {
+    JMTState start_s, start_d;
+    Quintic *s_profiles = nullptr; // duration * speeds + speed
+    Quintic *d_profiles = nullptr; // duration * lanes + lane
+    double *v_max = nullptr, *a_max = nullptr, *j_max = nullptr;
+    double *cost = nullptr;
+    int size = 0;
+};
+
+class LatticePlanner {
+public:
+    explicit LatticePlanner(const LatticeConfig &config = LatticeConfig());
+
+    const LatticeConfig &config() const { return config_; }
+
+    double speed(int speed) const;
+    double duration(int duration) const;
+
+    // Solve s(t) and d(t) of every candidate from the start state, the arrays come from arena
+    void prepare(const JMTState &start_s, const JMTState &start_d, TickArena &arena, LatticeCandidates &candidates) const;
+
+    // Cost of the candidates of one duration, the cars are time_offset seconds behind the start state.
+    // Durations write disjoint candidates, so they can be evaluated concurrently, each with its own arena.
+    void evaluate(int duration, const LatticeTraffic &traffic, double time_offset, int goal_lane, TickArena &arena,
+                  LatticeCandidates &candidates) const;
+
+    // Leave the candidates of one duration out, e.g. when there is no time left to evaluate them: they cost infinity
+    void skip(int duration, LatticeCandidates &candidates) const;
+
+    // Cheapest candidate, the first one in candidate order if there are several
+    int best(const LatticeCandidates &candidates) const;
+
+    // Lane, target speed index and duration index of candidate c
+    void split(int c, int &lane, int &speed, int &duration) const;
+
+private:
+    LatticeConfig config_;
+};
+
+#endif /* LATTICE_PLANNER_H */
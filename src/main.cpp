@@ -1,12 +1,28 @@
 #include <fstream>
 #include <math.h>
 #include <uWS/uWS.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <thread>
 #include <vector>
 #include "json.hpp"
 #include "spline.h"
+#include "trajectory_buffer.h"
+#include "arc_length_table.h"
+#include "candidate_pool.h"
+#include "jmt.h"
+#include "highway_map.h"
+#include "lattice_planner.h"
+#include "primitive_library.h"
+#include "map_reloader.h"
+#ifdef EMBED_MAP
+#include "embedded_map.h"
+#endif
 
 using namespace std;
 
@@ -19,6 +35,20 @@ struct Ego{
     double goal_s; // how far along the goal lane Ego is to travel, used when state is LCL or LCR
 };
 
+// Counters of the anytime mode (--deadline=MS). A hit is a frame whose deadline expired before all its lane change
+// candidates were evaluated, an overrun one that was answered after its deadline. Slack is the time left when a
+// frame is answered, negative for overruns.
+struct DeadlineStats{
+
+    long frames = 0, hits = 0, overruns = 0;
+    long candidates = 0, dropped = 0;
+    double slack_sum = 0.0; // ms
+    double slack_min = numeric_limits<double>::infinity();
+};
+
+// One car of the sensor fusion data: id, x, y, vx, vy, s, d
+typedef array<double, 7> FusionCar;
+
 // For converting back and forth between radians and degrees.
 constexpr double pi() { return M_PI; }
 
@@ -30,19 +60,6 @@ double logistic(double x){
     return 2.0 / (1 + exp(-x)) - 1.0; // as x goes from -inf to +inf, y goes from -1 to 1. When x=0, y=0
 }
 
-double meanOfVector(vector<double> x){
-    double tot;
-    for(auto i: x) tot += i;
-    return tot/x.size();
-}
-
-double maxofVector(vector<double> x){
-    double biggest = x[0];
-    for(auto i: x)
-        if (biggest < i) biggest = i;
-    return biggest;
-}
-
 // Checks if the SocketIO event has JSON data.
 // If there is data the JSON object in string format will be returned,
 // else the empty string "" will be returned.
@@ -62,111 +79,6 @@ double distance(double x1, double y1, double x2, double y2) {
     return sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
 }
 
-int ClosestWaypoint(double x, double y, vector<double> maps_x, vector<double> maps_y) {
-
-    double closestLen = 100000; //large number
-    int closestWaypoint = 0;
-
-    for (int i = 0; i < maps_x.size(); i++) {
-        double map_x = maps_x[i];
-        double map_y = maps_y[i];
-        double dist = distance(x, y, map_x, map_y);
-        if (dist < closestLen) {
-            closestLen = dist;
-            closestWaypoint = i;
-        }
-
-    }
-
-    return closestWaypoint;
-}
-
-int NextWaypoint(double x, double y, double theta, vector<double> maps_x, vector<double> maps_y) {
-
-    int closestWaypoint = ClosestWaypoint(x, y, maps_x, maps_y);
-
-    double map_x = maps_x[closestWaypoint];
-    double map_y = maps_y[closestWaypoint];
-
-    double heading = atan2((map_y - y), (map_x - x)); // atan2 in [-PI, PI], where wp is w.r.t. car
-
-    double angle = abs(theta - heading); // difference in car yaw and heading
-
-    if (angle > pi() / 4) // if point is not in car's line of sight, consider it behind
-        closestWaypoint++;
-
-    return closestWaypoint;
-}
-
-// Transform from Cartesian x,y coordinates to Frenet s,d coordinates
-vector<double> getFrenet(double x, double y, double theta, vector<double> maps_x, vector<double> maps_y) {
-    int next_wp = NextWaypoint(x, y, theta, maps_x, maps_y);
-
-    int prev_wp;
-    prev_wp = next_wp - 1;
-    if (next_wp == 0) {
-        prev_wp = maps_x.size() - 1;
-    }
-
-    double n_x = maps_x[next_wp] - maps_x[prev_wp];
-    double n_y = maps_y[next_wp] - maps_y[prev_wp];
-    double x_x = x - maps_x[prev_wp];
-    double x_y = y - maps_y[prev_wp];
-
-    // find the projection of x onto n
-    double proj_norm = (x_x * n_x + x_y * n_y) / (n_x * n_x + n_y * n_y);
-    double proj_x = proj_norm * n_x;
-    double proj_y = proj_norm * n_y;
-
-    double frenet_d = distance(x_x, x_y, proj_x, proj_y);
-
-    //see if d value is positive or negative by comparing it to a center point
-
-    double center_x = 1000 - maps_x[prev_wp];
-    double center_y = 2000 - maps_y[prev_wp];
-    double centerToPos = distance(center_x, center_y, x_x, x_y);
-    double centerToRef = distance(center_x, center_y, proj_x, proj_y);
-
-    if (centerToPos <= centerToRef) {
-        frenet_d *= -1;
-    }
-
-    // calculate s value
-    double frenet_s = 0;
-    for (int i = 0; i < prev_wp; i++) {
-        frenet_s += distance(maps_x[i], maps_y[i], maps_x[i + 1], maps_y[i + 1]);
-    }
-
-    frenet_s += distance(0, 0, proj_x, proj_y);
-
-    return {frenet_s, frenet_d};
-}
-
-// Transform from Frenet s,d coordinates to Cartesian x,y
-vector<double> getXY(double s, double d, vector<double> maps_s, vector<double> maps_x, vector<double> maps_y) {
-    int prev_wp = -1;
-
-    while (s > maps_s[prev_wp + 1] && (prev_wp < (int) (maps_s.size() - 1))) {
-        prev_wp++;
-    }
-
-    int wp2 = (prev_wp + 1) % maps_x.size();
-
-    double heading = atan2((maps_y[wp2] - maps_y[prev_wp]), (maps_x[wp2] - maps_x[prev_wp]));
-    // the x,y,s along the segment
-    double seg_s = (s - maps_s[prev_wp]);
-
-    double seg_x = maps_x[prev_wp] + seg_s * cos(heading);
-    double seg_y = maps_y[prev_wp] + seg_s * sin(heading);
-
-    double perp_heading = heading - pi() / 2;
-
-    double x = seg_x + d * cos(perp_heading);
-    double y = seg_y + d * sin(perp_heading);
-
-    return {x, y};
-}
-
 // Calculate lane number given d value
 int calculateLane(double d){
     int lane;
@@ -182,95 +94,109 @@ int calculateLane(double d){
     return lane;
 }
 
-// Get trajectory readings s[], d[], v[], a[], j[], given a trajectory (x[],y[])
-vector<vector<double>> getTrajectoryReadings(vector<vector<double>> trajectory, vector<double> maps_x, vector<double> maps_y){
+// Get trajectory readings s[], d[] and the max speed, acceleration and jerk and mean speed, given a trajectory (x[],y[]).
+// The s,d of points 1..known are copied from known_s[], known_d[] if given, e.g. those of the previous path every
+// candidate starts with. The other points continue from known_end, a cursor left at the last known point.
+void getTrajectoryReadings(const TrajectoryBuffer &trajectory, const HighwayMap &map, TickArena &arena,
+                           TrajectoryReadings &readings, const double *known_s = nullptr, const double *known_d = nullptr,
+                           int known = 0, const FrenetCursor *known_end = nullptr){
 
-    vector<double> x, y, theta, s, d, vx, vy, vxy, ax, ay, axy, jx, jy, jxy;
+    const double *x = trajectory.x, *y = trajectory.y;
+    int n = trajectory.size;
 
-    for(int i = 0; i < trajectory.size(); i++){
-        x.push_back(trajectory[i][0]);
-        y.push_back(trajectory[i][1]);
+    if (n <= 5){
+        readings.allocate(arena, 0);
+        return;
     }
+    readings.allocate(arena, n-1);
 
-    if (x.size()>5){
+    // one pass over the points, the finite differences only need the last velocity and acceleration
+    double *theta = arena.allocate<double>(n-1);
+    double vx_prev = 0.0, vy_prev = 0.0, ax_prev = 0.0, ay_prev = 0.0;
+    double v_sum = 0.0;
+    for (int i = 0; i < n-1; i ++){
 
-        for (int i = 0; i < x.size() -1; i ++){
-            double temp_theta = atan2((y[i+1] - y[i]), (x[i+1] - x[i]));
-            theta.push_back(temp_theta);
-            vector<double> temp_sd = getFrenet(x[i+1], y[i+1], temp_theta, maps_x, maps_y);
-            s.push_back(temp_sd[0]);
-            d.push_back(temp_sd[1]);
-        }
-
-        for (int j = 0; j < s.size()-1; j ++){
-            double temp_vx = (x[j+1]-x[j])/0.02;
-            double temp_vy = (y[j+1]-y[j])/0.02;
-
-            vx.push_back(temp_vx);
-            vy.push_back(temp_vy);
-
-            vxy.push_back(sqrt(temp_vx*temp_vx + temp_vy*temp_vy));
-        }
-
-        for (int j = 0; j < vx.size()-1; j ++){
-            double temp_ax = (vx[j+1]-vx[j])/0.02;
-            double temp_ay = (vy[j+1]-vy[j])/0.02;
-
-            ax.push_back(temp_ax);
-            ay.push_back(temp_ay);
-
-            axy.push_back(sqrt(temp_ax*temp_ax + temp_ay*temp_ay));
-        }
-
-        for (int j = 0; j < ax.size()-1; j ++){
-            double temp_jx = (ax[j+1]-ax[j])/0.02;
-            double temp_jy = (ay[j+1]-ay[j])/0.02;
-
-            jx.push_back(temp_jx);
-            jy.push_back(temp_jy);
+        theta[i] = atan2((y[i+1] - y[i]), (x[i+1] - x[i]));
+        if (i == n-2)
+            break;
 
-            jxy.push_back(sqrt(temp_jx*temp_jx + temp_jy*temp_jy));
+        double vx = (x[i+1]-x[i])/0.02;
+        double vy = (y[i+1]-y[i])/0.02;
+        double v = sqrt(vx*vx + vy*vy);
+        v_sum += v;
+        readings.v_max = i == 0 ? v : max(readings.v_max, v);
+
+        if (i >= 1){
+            double ax = (vx-vx_prev)/0.02;
+            double ay = (vy-vy_prev)/0.02;
+            double a = sqrt(ax*ax + ay*ay);
+            readings.a_max = i == 1 ? a : max(readings.a_max, a);
+
+            if (i >= 2){
+                double jx = (ax-ax_prev)/0.02;
+                double jy = (ay-ay_prev)/0.02;
+                double j = sqrt(jx*jx + jy*jy);
+                readings.j_max = i == 2 ? j : max(readings.j_max, j);
+            }
+            ax_prev = ax;
+            ay_prev = ay;
         }
-
+        vx_prev = vx;
+        vy_prev = vy;
     }
-
-    return {s, d, vxy, axy, jxy};
+    readings.v_mean = v_sum/(n-2);
+
+    // s,d of the other points up to n-1 in one pass
+    known = min(known, n-1);
+    copy(known_s, known_s + known, readings.s);
+    copy(known_d, known_d + known, readings.d);
+    FrenetCursor cursor = known_end && known > 0 ? *known_end : FrenetCursor(map);
+    cursor.getFrenetBatch(&x[1+known], &y[1+known], theta+known, n-1-known, readings.s+known, readings.d+known);
+    readings.size = n-1;
 }
 
 // Generate anchor points (s,d) at the end of the previous path, look behind rather than looking ahead.
-vector<vector<double>> generateAnchors(double car_s, vector<vector<double>> sensor_fusion, int lane, double ego_speed, double ego_s){
+void generateAnchors(double car_s, const FusionCar *sensor_fusion, int cars, int lane, double ego_speed, double ego_s,
+                     TickArena &arena, TrajectoryBuffer &anchors){
 
-    vector<int> lanes; // lanes to consider
-    lanes.push_back(lane-1); lanes.push_back(lane+1);
+    int lanes[2] = {lane-1, lane+1}; // lanes to consider
 
-    vector<vector<double>> anchors;
+    // at most one anchor every metre over 30m per lane, in s and d
+    anchors.allocate(arena, 64, true);
     int temp_anchors_count = 0;
 
+    int *cars_in_lane = arena.allocate<int>(cars);
+    double *time_to_pass = arena.allocate<double>(cars);
+    double *pass_id = arena.allocate<double>(cars);
+    double *marks = arena.allocate<double>(cars);
+
     for(auto l: lanes){
         if(l > -1 && l < 3) {
-            vector<vector<double>> cars_in_lane_sf;
+            int cars_in_lane_count = 0;
 
             // collect cars in the lane that's being considered
-            for (auto sf: sensor_fusion) {
+            for (int c = 0; c < cars; c++) {
+                const FusionCar &sf = sensor_fusion[c];
                 if (sf[6] > (double)l * 4 && sf[6] < ((double)l + 1) * 4) {
-                    cars_in_lane_sf.push_back(sf);
+                    cars_in_lane[cars_in_lane_count++] = c;
                 }
             }
 
             // if any of them in the way of a lane change
             bool in_the_way = false;
-            for (auto sf: cars_in_lane_sf){
+            for (int c = 0; c < cars_in_lane_count; c++){
+                const FusionCar &sf = sensor_fusion[cars_in_lane[c]];
                 if (sf[5] > ego_s && sf[5] - ego_s < 30)
                     in_the_way = true;
             }
 
-
-            vector<double> time_to_pass; // how long it would take for any car in this lane that's 60m behind to overtake Ego under 1.5 seconds
-            vector<double> pass_id; // their IDs
-            vector<double> marks; // s values where the overtake happens plus 15m
+            // how long it would take for any car in this lane that's 60m behind to overtake Ego under 1.5 seconds,
+            // their IDs and s values where the overtake happens plus 15m
+            int marks_count = 0;
 
             // gather information on cars that will overtake Ego
-            for(auto sf: cars_in_lane_sf){
+            for (int c = 0; c < cars_in_lane_count; c++){
+                const FusionCar &sf = sensor_fusion[cars_in_lane[c]];
 
                 double check_speed = sqrt(sf[3] * sf[3] + sf[4] * sf[4]);
 
@@ -279,26 +205,28 @@ vector<vector<double>> generateAnchors(double car_s, vector<vector<double>> sens
                     double temp_time_to_pass = (car_s - sf[5])/(ego_speed);
 
                     if(temp_time_to_pass > 0 && temp_time_to_pass < 1.5){
-                        marks.push_back(sf[5] + temp_time_to_pass * check_speed + 5);
-                        time_to_pass.push_back(temp_time_to_pass);
-                        pass_id.push_back(sf[0]);
+                        marks[marks_count] = sf[5] + temp_time_to_pass * check_speed + 5;
+                        time_to_pass[marks_count] = temp_time_to_pass;
+                        pass_id[marks_count] = sf[0];
+                        marks_count++;
                     }
                 }
             }
 
-            cout << "Lane " << l << ": " << marks.size() << " cars to overtake Ego in 1.5 seconds" << endl;
+            cout << "Lane " << l << ": " << marks_count << " cars to overtake Ego in 1.5 seconds" << endl;
 
 
-            if (marks.size() > 0) { // if such cars are found, generate anchors trailing them if no other cars are nearby
+            if (marks_count > 0) { // if such cars are found, generate anchors trailing them if no other cars are nearby
 
                 for (double j = car_s; j < car_s + 30; j += 1){
                     bool ok_to_drop = true;
 
-                    for (int i = 0; i < marks.size(); i++){
+                    for (int i = 0; i < marks_count; i++){
                         double m = marks[i];
                         double t = time_to_pass[i];
 
-                        for(auto sf: cars_in_lane_sf){
+                        for (int c = 0; c < cars_in_lane_count; c++){
+                            const FusionCar &sf = sensor_fusion[cars_in_lane[c]];
                             double s = sf[5] + t * sqrt(sf[3] * sf[3] + sf[4] * sf[4]);
                             if(sf[0] != pass_id[i]){
                                 if ((m > s && m - s < 30) || (m <= s && s - m < 15))
@@ -311,129 +239,526 @@ vector<vector<double>> generateAnchors(double car_s, vector<vector<double>> sens
 
                     }
                     if (ok_to_drop)
-                        anchors.push_back({j, (double)2 + l * 4});
+                        anchors.push_back_frenet(j, (double)2 + l * 4);
                 }
             } else if (!in_the_way) {
                 // if no such cars are found, and there are no cars right next to ego, generate anchors beyond the end of the previous path
 
                 // drop an anchor point every 4m apart from the end of the previous path to 30m beyond that
                 for (double j = car_s; j < car_s + 30; j += 4){
-                    anchors.push_back({j, (double)2 + l * 4});
+                    anchors.push_back_frenet(j, (double)2 + l * 4);
                 }
 
             }
 
-            cout << "lane " << l << ": " << anchors.size()-temp_anchors_count << " anchors" << endl;
-            temp_anchors_count = anchors.size()-temp_anchors_count;
+            cout << "lane " << l << ": " << anchors.size-temp_anchors_count << " anchors" << endl;
+            temp_anchors_count = anchors.size-temp_anchors_count;
         }
     }
-
-    return anchors;
 }
 
-// Generate trajectory (x,y) from anchor (s, d)
-vector<vector<double>> generateTrajectory(vector<double> sd, vector<double> prev_path_x, vector<double> prev_path_y, double ref_v, int goal_lane,
-                                          vector<double> maps_s, vector<double> maps_x, vector<double> maps_y){
+// Local frame of a spline trajectory: origin at the end of the previous path, x along its last two points. The
+// spline goes through those two points and three anchors 30m apart in the goal lane, given in that frame.
+struct SplineFrame{
+    double ref_x, ref_y, ref_yaw;
+    array<double, 5> pts_x, pts_y;
+};
+
+void getSplineFrame(double anchor_s, const TrajectoryBuffer &prev_path, int goal_lane, const HighwayMap &map, SplineFrame &frame){
 
-    vector<vector<double>> trajectory;
-    vector<double> pts_x, pts_y;
+    array<double, 5> &pts_x = frame.pts_x, &pts_y = frame.pts_y;
+    int prev_size = prev_path.size;
 
     // add two points to pts_x and pts_y
     for (int i = 2; i > 0; i --){
-        pts_x.push_back(prev_path_x[prev_path_x.size()-i]);
-        pts_y.push_back(prev_path_y[prev_path_y.size()-i]);
+        pts_x[2-i] = prev_path.x[prev_size-i];
+        pts_y[2-i] = prev_path.y[prev_size-i];
     }
 
-    double ref_x = pts_x[1];
-    double ref_y = pts_y[1];
+    frame.ref_x = pts_x[1];
+    frame.ref_y = pts_y[1];
     double ref_prev_x = pts_x[0];
     double ref_prev_y = pts_y[0];
-    double ref_yaw = atan2((ref_y - ref_prev_y), (ref_x - ref_prev_x));
+    frame.ref_yaw = atan2((frame.ref_y - ref_prev_y), (frame.ref_x - ref_prev_x));
 
-    // add another four points to pts_x and pts_y
+    // add another three points to pts_x and pts_y, 30m apart in the goal lane
+    double pts_s[3], pts_d[3];
     for (int i = 1; i < 4; i ++){
-        vector<double> xy = getXY(sd[0]+30*i, (2+4*goal_lane), maps_s, maps_x, maps_y);
-
-        pts_x.push_back(xy[0]);
-        pts_y.push_back(xy[1]);
+        pts_s[i-1] = anchor_s+30*i;
+        pts_d[i-1] = 2+4*goal_lane;
     }
+    map.getXYBatch(pts_s, pts_d, 3, &pts_x[2], &pts_y[2]);
 
     // transform from global to local coordinates
     for(int i = 0; i < pts_x.size(); i++)
     {
-        double shift_x = pts_x[i]-ref_x;
-        double shift_y = pts_y[i]-ref_y;
+        double shift_x = pts_x[i]-frame.ref_x;
+        double shift_y = pts_y[i]-frame.ref_y;
 
-        pts_x[i] = shift_x*cos(0 - ref_yaw) - shift_y*sin(0 - ref_yaw);
-        pts_y[i] = shift_x*sin(0 - ref_yaw) + shift_y*cos(0 - ref_yaw);
+        pts_x[i] = shift_x*cos(0 - frame.ref_yaw) - shift_y*sin(0 - frame.ref_yaw);
+        pts_y[i] = shift_x*sin(0 - frame.ref_yaw) + shift_y*cos(0 - frame.ref_yaw);
     }
+}
 
-    // fit spline
-    tk::spline s;
-    s.set_points(pts_x, pts_y);
+// Length of the trajectories in points, 0.02s apart. The simulator is sent the first output points, lane change
+// candidates are costed over the first evaluation points. The generators only compute the points up to the horizon
+// their caller reads, e.g. the trajectory of a frame that keeps its lane is never costed.
+struct TrajectoryHorizon{
+    int output = 50;
+    int evaluation = 75;
+};
 
-    // populate trajectory with previous path first
-    for(int i = 0; i < prev_path_x.size(); i++)
-        trajectory.push_back({prev_path_x[i], prev_path_y[i]});
+// most points a trajectory may have, the horizons are at most this long
+const int max_trajectory_points = 90;
 
-    // plan 30m ahead along car's x direction
-    double target_x = 30.0;
-    double target_y = s(target_x);
-    double target_distance = sqrt(target_x*target_x+target_y*target_y);
-    double x_add_on = 0.0;
+// Spline of the last trajectory generateTrajectory() made for the ego, with the arc length of each of its new
+// points. While goal_lane and ref_v stay the same, the next call picks up the point the previous path ends on
+// and continues along the same spline instead of fitting a new one.
+struct SplinePlan{
 
-    // add on to previous path using points from spline
-    for (int i = 1; i <= 90 - prev_path_x.size(); i ++){
+    bool valid = false;
+    int goal_lane;
+    double ref_v;
 
-        double N = target_distance/(ref_v/2.24*0.02);
+    // local frame and spline, the arc length table points into curve so plans are not copied
+    double ref_x, ref_y, ref_yaw;
+    tk::fixed_spline<5> curve;
+    ArcLengthTable<tk::fixed_spline<5> > arc_length;
 
-        double x_point = x_add_on + target_x/N;
-        double y_point = s(x_point);
+    int points = 0;
+    double point_x[max_trajectory_points], point_y[max_trajectory_points], point_arc[max_trajectory_points];
+};
 
-        x_add_on = x_point;
+// the spline is followed while the previous path ends at most this far along it. Past that the anchors, which
+// move with the car, have drifted enough that the seam to the next fit shows up as jerk.
+const double plan_reuse_arc = 2.0;
+
+// Generate trajectory (x,y) of points points from anchor (s, d)
+void generateTrajectory(double anchor_s, const TrajectoryBuffer &prev_path, double ref_v, int goal_lane, int points, const HighwayMap &map,
+                        TickArena &arena, TrajectoryBuffer &trajectory, SplinePlan *plan = nullptr){
+
+    SplinePlan local_plan;
+    SplinePlan &p = plan ? *plan : local_plan;
+
+    const double *prev_path_x = prev_path.x, *prev_path_y = prev_path.y;
+    int prev_size = prev_path.size;
+    int add_on = points - prev_size;
+    double step = ref_v/2.24*0.02;
+
+    // a previous path as long as the trajectory ends where the plan has its points, it is kept for the next call
+    if (add_on <= 0){
+        trajectory.allocate(arena, prev_size);
+        for(int i = 0; i < prev_size; i++)
+            trajectory.push_back(prev_path_x[i], prev_path_y[i]);
+        trajectory.size = min(trajectory.size, points);
+        return;
+    }
+
+    // continue the plan from the new point the previous path ends on, the simulator echoes it back rounded
+    double start_arc = 0.0;
+    double start_curvature = 0.0;
+    bool extend = false;
+    if (plan && p.valid){
+        double last_x = prev_path_x[prev_size-1];
+        double last_y = prev_path_y[prev_size-1];
+        for (int j = p.points - 1; j >= 0; j --){
+            if ((p.point_x[j]-last_x)*(p.point_x[j]-last_x) + (p.point_y[j]-last_y)*(p.point_y[j]-last_y) < 1e-4){
+                start_arc = p.point_arc[j];
+                start_curvature = p.curve.curvature(p.arc_length.xAt(start_arc));
+                extend = p.goal_lane == goal_lane && p.ref_v == ref_v && start_arc <= plan_reuse_arc;
+                break;
+            }
+        }
+    }
+
+    if (!extend){
+
+        start_arc = 0.0;
+        SplineFrame frame;
+        getSplineFrame(anchor_s, prev_path, goal_lane, map, frame);
+        p.ref_x = frame.ref_x;
+        p.ref_y = frame.ref_y;
+        p.ref_yaw = frame.ref_yaw;
+
+        // fit spline, the 5 points fit on the stack. A spline that continues the plan starts with its curvature
+        // so the points do not jerk at the seam, the local frame is aligned with the curve there.
+        p.curve.set_boundary(tk::spline::second_deriv, start_curvature, tk::spline::second_deriv, 0.0);
+        p.curve.set_points(frame.pts_x, frame.pts_y);
+
+        // long enough for a full set of new points from anywhere the plan may be continued, whatever the horizon
+        p.arc_length.build(p.curve, 0.0, plan_reuse_arc + max_trajectory_points*step);
+    }
+
+    // populate trajectory with previous path first
+    trajectory.allocate(arena, prev_size + add_on);
+    for(int i = 0; i < prev_size; i++)
+        trajectory.push_back(prev_path_x[i], prev_path_y[i]);
 
-        double x_ref = x_point;
-        double y_ref = y_point;
+    // add on to previous path using points from spline, spaced ref_v*0.02 apart along the curve
+    double arc_points[max_trajectory_points], x_points[max_trajectory_points], y_points[max_trajectory_points];
+    for (int i = 0; i < add_on; i ++)
+        arc_points[i] = start_arc + (i+1)*step;
+    p.arc_length.xAtSorted(arc_points, add_on, x_points);
+
+    // sampled in one pass since x only grows
+    p.curve.eval_sorted(x_points, add_on, y_points);
+
+    p.points = add_on;
+    for (int i = 0; i < add_on; i ++){
+
+        double x_ref = x_points[i];
+        double y_ref = y_points[i];
 
         // transform from local to global coordinates
-        x_point = ref_x + x_ref*cos(ref_yaw)-y_ref*sin(ref_yaw);
-        y_point = ref_y + x_ref*sin(ref_yaw)+y_ref*cos(ref_yaw);
+        double x_point = p.ref_x + x_ref*cos(p.ref_yaw)-y_ref*sin(p.ref_yaw);
+        double y_point = p.ref_y + x_ref*sin(p.ref_yaw)+y_ref*cos(p.ref_yaw);
+
+        trajectory.push_back(x_point, y_point);
+        p.point_x[i] = x_point;
+        p.point_y[i] = y_point;
+        p.point_arc[i] = arc_points[i];
+    }
+
+    p.valid = true;
+    p.goal_lane = goal_lane;
+    p.ref_v = ref_v;
+
+}
+
+// Motion primitive the ego follows, placed at the end of an earlier previous path, with the time along it of each of its
+// new points. Like SplinePlan, the next call picks up the point the previous path ends on and continues from there. Past
+// its duration the primitive holds its end speed in its end lane.
+struct PrimitivePlan{
+
+    bool valid = false;
+    Quintic s, d;
+    double duration;
+
+    int points = 0;
+    double point_x[max_trajectory_points], point_y[max_trajectory_points], point_t[max_trajectory_points];
+};
 
-        trajectory.push_back({x_point, y_point});
+// Working memory of one CandidatePool worker
+struct CandidateScratch{
+    SplinePlan plan;
+    PrimitivePlan primitive_plan;
+    TickArena arena;
+};
+
+// Spline candidate for the anchor at anchor_s and its readings. prefix_s[], prefix_d[] are the s,d of the previous
+// path points 1..n-1, which every candidate shares, and prefix_end the cursor they were taken with.
+void evaluateSplineCandidate(double anchor_s, const TrajectoryBuffer &prev_path, const double *prefix_s, const double *prefix_d,
+                             const FrenetCursor &prefix_end, double ref_v, int goal_lane, int points, const HighwayMap &map,
+                             CandidateScratch &scratch, TrajectoryBuffer &trajectory, TrajectoryReadings &readings){
+
+    // a fresh fit per candidate, the plan is only storage
+    scratch.plan.valid = false;
+    generateTrajectory(anchor_s, prev_path, ref_v, goal_lane, points, map, scratch.arena, trajectory, &scratch.plan);
+    getTrajectoryReadings(trajectory, map, scratch.arena, readings, prefix_s, prefix_d, prev_path.size-1, &prefix_end);
+}
+
+// s,d of the previous path points 1..n-1 into prev_s[], prev_d[] and the state at its end, where jerk-minimizing
+// trajectories start. The speed is ref_v until the path has enough points for finite differences.
+void getPathEndState(const TrajectoryBuffer &prev_path, double ref_v, const HighwayMap &map, TickArena &arena,
+                     double *prev_s, double *prev_d, JMTState &start_s, JMTState &start_d){
+
+    const double *prev_path_x = prev_path.x, *prev_path_y = prev_path.y;
+    int prev_size = prev_path.size;
+
+    double *theta = arena.allocate<double>(prev_size-1);
+    for (int i = 1; i < prev_size; i ++)
+        theta[i-1] = atan2(prev_path_y[i] - prev_path_y[i-1], prev_path_x[i] - prev_path_x[i-1]);
+    map.getFrenetBatch(&prev_path_x[1], &prev_path_y[1], theta, prev_size-1, prev_s, prev_d);
+
+    int last = prev_size-2;
+    start_s = {prev_s[last], ref_v/2.24, 0.0};
+    start_d = {prev_d[last], 0.0, 0.0};
+    if (last >= 2){
+        start_s.v = (prev_s[last] - prev_s[last-1])/0.02;
+        start_s.a = (prev_s[last] - 2*prev_s[last-1] + prev_s[last-2])/(0.02*0.02);
+        start_d.v = (prev_d[last] - prev_d[last-1])/0.02;
+        start_d.a = (prev_d[last] - 2*prev_d[last-1] + prev_d[last-2])/(0.02*0.02);
+    }
+}
+
+// Jerk-minimizing alternative to generateTrajectory(): quintic s(t) and d(t) from the end of the previous path to ref_v
+// in the goal lane, one trajectory of points points per candidate. Like the spline through its anchors, candidate l
+// reaches its goal lane 30m past anchor_s[l], at the mean of the start speed and ref_v and in no less than jmt_horizon
+// seconds. A candidate that comes out the same as an earlier one, e.g. every anchor of a lane too close for more than
+// jmt_horizon, shares its trajectory and gets its index in same_as[l], -1 otherwise. The readings reuse the s,d of the
+// previous path and take those of the new points from the polynomials, the rest like getTrajectoryReadings().
+// Candidates are generated in order until the deadline, if there is one, returns how many were.
+const double jmt_horizon = 2.0;
+
+int generateTrajectoriesJMT(const double *anchor_s, const int *goal_lanes, int lanes, const TrajectoryBuffer &prev_path,
+                            double ref_v, int points, const HighwayMap &map, TickArena &arena, TrajectoryBuffer *trajectories,
+                            TrajectoryReadings *readings, int *same_as,
+                            const chrono::steady_clock::time_point *deadline = nullptr){
+
+    const double *prev_path_x = prev_path.x, *prev_path_y = prev_path.y;
+    int prev_size = prev_path.size;
+
+    // s,d of the previous path points 1..n-1, the last ones give the start state
+    double *prev_s = arena.allocate<double>(prev_size-1), *prev_d = arena.allocate<double>(prev_size-1);
+    JMTState start_s, start_d;
+    getPathEndState(prev_path, ref_v, map, arena, prev_s, prev_d, start_s, start_d);
+    int last = prev_size-2;
+    double end_v = ref_v/2.24;
+    double mean_v = max((start_s.v + end_v)/2, 1.0);
+
+    // s,d of the points 1.. of a candidate, the kept ones from the previous path and then the new points every 0.02s
+    // after its end, up to points points in total
+    int add_on = max(points - prev_size, 0);
+    int kept = min(prev_size, points);
+    int kept_sd = min(last+1, points-1);
+    double *s = arena.allocate<double>(kept_sd + add_on), *d = arena.allocate<double>(kept_sd + add_on);
+    double *v = arena.allocate<double>(add_on), *a = arena.allocate<double>(add_on), *j = arena.allocate<double>(add_on);
+    copy(prev_s, prev_s + kept_sd, s);
+    copy(prev_d, prev_d + kept_sd, d);
+
+    double *durations = arena.allocate<double>(lanes);
+    for (int l = 0; l < lanes; l ++){
+
+        durations[l] = max(jmt_horizon, (anchor_s[l] + 30 - start_s.p)/mean_v);
+        int same = -1;
+        for (int m = 0; m < l && same < 0; m ++)
+            if (goal_lanes[m] == goal_lanes[l] && durations[m] == durations[l])
+                same = m;
+        if (same_as)
+            same_as[l] = same;
+        if (same >= 0){
+            trajectories[l] = trajectories[same];
+            if (readings)
+                readings[l] = readings[same];
+            continue;
+        }
+        if (deadline && chrono::steady_clock::now() >= *deadline)
+            return l;
+
+        double T = durations[l];
+        JMTState end_s = {start_s.p + T*mean_v, end_v, 0.0};
+        JMTState end_d = {2.0+4*goal_lanes[l], 0.0, 0.0};
+        sampleJMT(solveJMT(start_s, end_s, T), T, 0.02, 0.02, add_on, s + kept_sd, v, a, j);
+        sampleJMT(solveJMT(start_d, end_d, T), T, 0.02, 0.02, add_on, d + kept_sd, v, a, j);
+
+        TrajectoryBuffer &trajectory = trajectories[l];
+        trajectory.allocate(arena, kept + add_on);
+        for (int i = 0; i < kept; i ++)
+            trajectory.push_back(prev_path_x[i], prev_path_y[i]);
+        map.getXYBatch(s + kept_sd, d + kept_sd, add_on, trajectory.x + kept, trajectory.y + kept);
+        trajectory.size += add_on;
+
+        // speed, acceleration and jerk over the whole trajectory, the previous path included
+        if (readings)
+            getTrajectoryReadings(trajectory, map, arena, readings[l], s, d, kept_sd + add_on);
+    }
+    return lanes;
+}
+
+// generateTrajectory() interface for a single jerk-minimizing trajectory
+void generateTrajectoryJMT(double anchor_s, const TrajectoryBuffer &prev_path, double ref_v, int goal_lane, int points,
+                           const HighwayMap &map, TickArena &arena, TrajectoryBuffer &trajectory){
+    generateTrajectoriesJMT(&anchor_s, &goal_lane, 1, prev_path, ref_v, points, map, arena, &trajectory, nullptr, nullptr);
+}
+
+// Trajectory of points points along the primitive of from. Once that is done, the library primitive that takes the end of
+// the previous path to ref_v in the goal lane is placed there, found by lookup instead of fitting. A lane change takes the
+// valid duration closest to reaching the goal lane 30m past anchor_s, a speed change the shortest one. to is the plan of
+// the trajectory and may be from. Returns false if the trajectory does not head for the goal lane, e.g. while the last
+// primitive is still going.
+bool generateTrajectoryPrimitive(double anchor_s, const TrajectoryBuffer &prev_path, double ref_v, int goal_lane, int points,
+                                 const PrimitiveLibrary &library, const HighwayMap &map, const PrimitivePlan &from,
+                                 TickArena &arena, TrajectoryBuffer &trajectory, PrimitivePlan &to){
+
+    PrimitivePlan last = from;
+    const double *prev_path_x = prev_path.x, *prev_path_y = prev_path.y;
+    int prev_size = prev_path.size;
+
+    // time along the last primitive of the point the previous path ends on, the simulator echoes it back rounded
+    double t0 = -1.0;
+    if (last.valid){
+        double last_x = prev_path_x[prev_size-1];
+        double last_y = prev_path_y[prev_size-1];
+        for (int j = last.points - 1; j >= 0; j --){
+            if ((last.point_x[j]-last_x)*(last.point_x[j]-last_x) + (last.point_y[j]-last_y)*(last.point_y[j]-last_y) < 1e-4){
+                t0 = last.point_t[j];
+                break;
+            }
+        }
+    }
+
+    Quintic quintic_s = last.s, quintic_d = last.d;
+    double T = last.duration;
+    if (t0 < 0){
+        // nothing to continue, start from the end of the previous path at its speed without its acceleration
+        double *prev_s = arena.allocate<double>(prev_size-1), *prev_d = arena.allocate<double>(prev_size-1);
+        JMTState start_s, start_d;
+        getPathEndState(prev_path, ref_v, map, arena, prev_s, prev_d, start_s, start_d);
+        quintic_s = {{start_s.p, start_s.v, 0.0, 0.0, 0.0, 0.0}};
+        quintic_d = {{start_d.p, 0.0, 0.0, 0.0, 0.0, 0.0}};
+        T = 0.0;
+        t0 = 0.0;
+    }
+
+    const PrimitiveGrid &grid = library.grid();
+    int end_lane = int(floor(quintic_d(T) / grid.lane_width));
+    bool heading = end_lane == goal_lane;
+
+    // a primitive that is done holds its end state, where the next one starts
+    if (t0 >= T){
+
+        double v0 = quintic_s.deriv(T, 1);
+        double s0 = quintic_s(T) + v0 * (t0 - T);
+        double d0 = quintic_d(T);
+
+        int lane_change = max(-grid.lanes, min(goal_lane - end_lane, grid.lanes));
+        int speed_change = library.speedChangeIndex(ref_v/2.24 - v0);
+        int no_speed_change = library.speedChangeIndex(0.0);
+        if (lane_change != 0 || speed_change != no_speed_change){
+
+            // a speed change no primitive makes from v0 is tried smaller
+            double hint = lane_change != 0 ? (anchor_s + 30 - s0)/max(v0, 1.0) : 0.0;
+            int duration = library.find(lane_change, speed_change, v0, hint);
+            while (duration < 0 && speed_change != no_speed_change){
+                speed_change += speed_change < no_speed_change ? 1 : -1;
+                duration = library.find(lane_change, speed_change, v0, hint);
+            }
+
+            if (duration >= 0){
+                library.place(lane_change, speed_change, duration, s0, v0, d0, quintic_s, quintic_d);
+                T = library.duration(duration);
+                t0 = 0.0;
+                heading = end_lane + lane_change == goal_lane;
+            }
+        }
     }
 
-    trajectory.resize(75);
-    return trajectory;
+    // populate trajectory with previous path first
+    int add_on = max(points - prev_size, 0);
+    int kept = min(prev_size, points);
+    trajectory.allocate(arena, kept + add_on);
+    for (int i = 0; i < kept; i ++)
+        trajectory.push_back(prev_path_x[i], prev_path_y[i]);
+
+    // new points every 0.02s along the primitive
+    double *s = arena.allocate<double>(add_on), *d = arena.allocate<double>(add_on);
+    double *v = arena.allocate<double>(add_on), *a = arena.allocate<double>(add_on), *j = arena.allocate<double>(add_on);
+    sampleJMT(quintic_s, T, t0 + 0.02, 0.02, add_on, s, v, a, j);
+    sampleJMT(quintic_d, T, t0 + 0.02, 0.02, add_on, d, v, a, j);
+    map.getXYBatch(s, d, add_on, trajectory.x + kept, trajectory.y + kept);
+    trajectory.size += add_on;
+
+    // a previous path as long as the trajectory ends where the last plan has its points
+    if (add_on == 0){
+        to = last;
+        return heading;
+    }
+
+    to.valid = true;
+    to.s = quintic_s;
+    to.d = quintic_d;
+    to.duration = T;
+    to.points = add_on;
+    for (int i = 0; i < add_on; i ++){
+        to.point_x[i] = trajectory.x[kept + i];
+        to.point_y[i] = trajectory.y[kept + i];
+        to.point_t[i] = t0 + 0.02 * (i+1);
+    }
+    return heading;
 }
 
-// calculate cost
-double calculateCost(vector<vector<double>> trajectory, vector<vector<double>> ego_readings, vector<vector<double>> sensor_fusion,
-                     int ego_cur_lane, int ego_goal_lane, double slow_car_speed, double slow_car_s){
+// Lattice planner: every candidate of the lattice from the end of the previous path is scored, one duration per task of
+// the pool, and the trajectory follows the cheapest one for points points in total. Returns that candidate. With a
+// deadline, the durations not started by then are left out.
+int generateTrajectoryLattice(const LatticePlanner &lattice, const TrajectoryBuffer &prev_path, double ref_v, int goal_lane,
+                              int points, const FusionCar *sensor_fusion, int cars, const HighwayMap &map,
+                              CandidatePool &pool, PerWorker<CandidateScratch> &scratch, TickArena &arena,
+                              LatticeCandidates &candidates, TrajectoryBuffer &trajectory,
+                              const chrono::steady_clock::time_point *deadline = nullptr){
+
+    int prev_size = prev_path.size;
+    double *prev_s = arena.allocate<double>(prev_size-1), *prev_d = arena.allocate<double>(prev_size-1);
+    JMTState start_s, start_d;
+    getPathEndState(prev_path, ref_v, map, arena, prev_s, prev_d, start_s, start_d);
+
+    double *car_s = arena.allocate<double>(cars), *car_v = arena.allocate<double>(cars), *car_d = arena.allocate<double>(cars);
+    for (int c = 0; c < cars; c ++){
+        const FusionCar &sf = sensor_fusion[c];
+        car_s[c] = sf[5];
+        car_v[c] = sqrt(sf[3] * sf[3] + sf[4] * sf[4]);
+        car_d[c] = sf[6];
+    }
+    LatticeTraffic traffic;
+    traffic.s = car_s;
+    traffic.v = car_v;
+    traffic.d = car_d;
+    traffic.size = cars;
+
+    // the cars are where sensor fusion saw them, the lattice starts when the ego reaches the end of the previous path
+    lattice.prepare(start_s, start_d, arena, candidates);
+    pool.run(lattice.config().durations, [&](int m, int worker) {
+        if (deadline && chrono::steady_clock::now() >= *deadline)
+            lattice.skip(m, candidates);
+        else
+            lattice.evaluate(m, traffic, prev_size * 0.02, goal_lane, scratch[worker].arena, candidates);
+    });
+
+    int best = lattice.best(candidates);
+    int lane, speed, duration;
+    lattice.split(best, lane, speed, duration);
+    const LatticeConfig &config = lattice.config();
+    const Quintic &quintic_s = candidates.s_profiles[duration * config.speeds + speed];
+    const Quintic &quintic_d = candidates.d_profiles[duration * config.lanes + lane];
+    double T = lattice.duration(duration);
+
+    // new points every 0.02s after the end of the previous path
+    int add_on = max(points - prev_size, 0);
+    double *s = arena.allocate<double>(add_on), *d = arena.allocate<double>(add_on);
+    double *v = arena.allocate<double>(add_on), *a = arena.allocate<double>(add_on), *j = arena.allocate<double>(add_on);
+    sampleJMT(quintic_s, T, 0.02, 0.02, add_on, s, v, a, j);
+    sampleJMT(quintic_d, T, 0.02, 0.02, add_on, d, v, a, j);
+
+    int kept = min(prev_size, points);
+    trajectory.allocate(arena, kept + add_on);
+    for (int i = 0; i < kept; i ++)
+        trajectory.push_back(prev_path.x[i], prev_path.y[i]);
+    map.getXYBatch(s, d, add_on, trajectory.x + kept, trajectory.y + kept);
+    trajectory.size += add_on;
+
+    cout << "Lattice: lane " << lane << " at " << lattice.speed(speed) * 2.24 << "mph in " << T << "s, cost "
+         << candidates.cost[best] << " of " << candidates.size << " candidates" << endl;
+    return best;
+}
+
+// a trajectory that calculateCost() or the lattice planner charges this much or more is never taken
+const double reject_cost = 10.0;
+
+// calculate cost, the reasons a trajectory is rejected go to out
+double calculateCost(const TrajectoryBuffer &trajectory, const TrajectoryReadings &ego_readings, const FusionCar *sensor_fusion,
+                     int cars, int ego_cur_lane, int ego_goal_lane, double slow_car_speed, double slow_car_s, TickArena &arena,
+                     ostream &out){
 
     double cost = 0.0;
 
-    vector<double> s, d, vsd, vxy, asd, axy, jsd, jxy;
-    s = ego_readings[0];
-    d = ego_readings[1];
-    vxy = ego_readings[2];
-    axy = ego_readings[3];
-    jxy = ego_readings[4];
+    const double *s = ego_readings.s, *d = ego_readings.d;
+    int sd_size = ego_readings.size;
 
-    double ego_end_s = s[s.size()-1];
-    double ego_vxy_max = maxofVector(vxy);
-    double ego_axy_max = maxofVector(axy);
-    double ego_jxy_max = maxofVector(jxy);
-    double ego_vxy_mean = meanOfVector(vxy);
+    double ego_end_s = s[sd_size-1];
+    double ego_vxy_max = ego_readings.v_max;
+    double ego_axy_max = ego_readings.a_max;
+    double ego_jxy_max = ego_readings.j_max;
+    double ego_vxy_mean = ego_readings.v_mean;
 
     double colli = 0.0, buffer = 0.0, v_lim = 0.0, a_lim = 0.0, j_lim = 0.0, effi = 0.0, road_lim = 0.0, baffled = 0.0;
 
-    vector<int> car_ahead_id;
-    vector<double> car_ahead_s;
-    vector<double> car_ahead_v;
+    int *car_ahead_id = arena.allocate<int>(cars);
+    double *car_ahead_s = arena.allocate<double>(cars);
+    double *car_ahead_v = arena.allocate<double>(cars);
+    int cars_ahead = 0;
 
     double closest_dist_ahead = 999;
 
-    int timesteps = 75;
+    int timesteps = sd_size;
     double center_line; // line between current lane and goal lane
 
     if(ego_goal_lane < ego_cur_lane){
@@ -443,19 +768,20 @@ double calculateCost(vector<vector<double>> trajectory, vector<vector<double>> e
     }
 
     // find out the time steps it takes for ego to go to the edge of its lane
-    for (int i = 0; i < s.size(); i ++){
+    for (int i = 0; i < sd_size; i ++){
         if (abs(d[i]-center_line)<0.5){
             timesteps = i;
             break;
         }
     }
 
-    for(auto sf: sensor_fusion){
+    for(int c = 0; c < cars; c++){
+        const FusionCar &sf = sensor_fusion[c];
 
         int check_car_id = sf[0];
         double check_car_speed = sqrt(sf[3] * sf[3] + sf[4] * sf[4]);
         double check_car_s0 = sf[5];
-        double check_car_s = check_car_s0 + ((double)trajectory.size() * 0.02 * check_car_speed);
+        double check_car_s = check_car_s0 + ((double)trajectory.size * 0.02 * check_car_speed);
         double check_car_d = sf[6];
         int check_car_lane = calculateLane(check_car_d);
 
@@ -486,46 +812,49 @@ double calculateCost(vector<vector<double>> trajectory, vector<vector<double>> e
             if(check_car_s0 > s[0]){
                 if (closest_dist_ahead > check_car_s0 - s[0]){
                     closest_dist_ahead = check_car_s0 - s[0];
-                    car_ahead_s.push_back(check_car_s0);
-                    car_ahead_v.push_back(check_car_speed);
-                    car_ahead_id.push_back(check_car_id);
+                    car_ahead_s[cars_ahead] = check_car_s0;
+                    car_ahead_v[cars_ahead] = check_car_speed;
+                    car_ahead_id[cars_ahead] = check_car_id;
+                    cars_ahead++;
                 }
             }
         }
     }
 
     // check to see if traffic around the slow car in goal lane is any faster
-    for(int i = 0; i < car_ahead_id.size(); i++){
+    for(int i = 0; i < cars_ahead; i++){
 
         if (((slow_car_s - car_ahead_s[i] < 20.0 && slow_car_s > car_ahead_s[i]) || (car_ahead_s[i] - slow_car_s < 10.0 && slow_car_s < car_ahead_s[i]))
             && car_ahead_v[i]/slow_car_speed < 1.15){
             baffled = 10.0;
-            cout << "Lane " << ego_goal_lane << " baffling" << endl;
+            out << "Lane " << ego_goal_lane << " baffling" << endl;
             goto Out;
         }
     }
 
     // check if trajectory stays inside the road limit
-    for(auto i: d){
-        int temp_lane = calculateLane(i);
+    for(int i = 0; i < sd_size; i++){
+        int temp_lane = calculateLane(d[i]);
         if (temp_lane < 0){
-            cout << "Lane " << ego_goal_lane << " road limit" << endl;
+            out << "Lane " << ego_goal_lane << " road limit" << endl;
             road_lim = 10.0;
             goto Out;
         }
     }
 
-    if(ego_vxy_max * 2.24 > 49.5)
+    if(ego_vxy_max > kSpeedLimit)
         v_lim = 10.0;
-    if(ego_axy_max > 10.0)
+    if(ego_axy_max > kAccelLimit)
         a_lim = 1.0;
+    // the jerk of the spline trajectories is measured over 0.02s steps, their threshold stays looser than
+    // the simulator's limit
     if(ego_jxy_max > 50.0)
         j_lim = 1.0;
 
     effi = logistic(abs(49.5 - ego_vxy_mean * 2.24)/50.0);
 
     Out:
-    if (colli == 10 && (baffled < 10 || road_lim < 10)) cout << "Lane " << ego_goal_lane << " collision" << endl;
+    if (colli == 10 && (baffled < 10 || road_lim < 10)) out << "Lane " << ego_goal_lane << " collision" << endl;
     cost = colli + buffer + v_lim + a_lim + j_lim + effi + road_lim + baffled;
 
 //    cout << ego_goal_lane <<": " << colli << ", " << baffled << ", "<< road_lim << " + " << buffer << ", " << effi << " + " << v_lim << ", " << a_lim << ", " << j_lim << endl;
@@ -533,52 +862,207 @@ double calculateCost(vector<vector<double>> trajectory, vector<vector<double>> e
     return cost;
 }
 
-int main() {
+// True if calculateCost() charges 10 or more to every trajectory into ego_goal_lane whose first reading is s0, d0,
+// e.g. the second point of the previous path. It checks the terms that do not depend on the rest of the trajectory:
+// a car in the goal lane next to that first point, a slow car the goal lane does not get around, or leaving the road.
+// Candidates into other lanes are not pruned by cost: every other term can be 0 until the trajectory is generated.
+bool laneRejected(double s0, double d0, const FusionCar *sensor_fusion, int cars, int ego_cur_lane, int ego_goal_lane,
+                  double slow_car_speed, double slow_car_s){
+
+    double center_line = ego_goal_lane < ego_cur_lane ? ego_cur_lane*4 : ego_goal_lane*4;
+    bool first_step = abs(d0-center_line) >= 0.5;
+
+    double closest_dist_ahead = 999;
+    for(int c = 0; c < cars; c++){
+        const FusionCar &sf = sensor_fusion[c];
+
+        double check_car_speed = sqrt(sf[3] * sf[3] + sf[4] * sf[4]);
+        double check_car_s0 = sf[5];
+        if (calculateLane(sf[6]) != ego_goal_lane)
+            continue;
+
+        // collision check at time step 0
+        if (first_step && ((s0>check_car_s0 && s0-check_car_s0<10) || (s0<check_car_s0 && check_car_s0-s0<20)))
+            return true;
+
+        // the cars calculateCost() collects as ahead in the goal lane, each closer than the ones before
+        if (check_car_s0 > s0 && closest_dist_ahead > check_car_s0 - s0){
+            closest_dist_ahead = check_car_s0 - s0;
+            if (((slow_car_s - check_car_s0 < 20.0 && slow_car_s > check_car_s0) || (check_car_s0 - slow_car_s < 10.0 && slow_car_s < check_car_s0))
+                && check_car_speed/slow_car_speed < 1.15)
+                return true;
+        }
+    }
+
+    if (calculateLane(d0) < 0)
+        return true;
+
+    return false;
+}
+
+int main(int argc, char *argv[]) {
     uWS::Hub h;
 
-    // Load up map values for waypoint's x,y,s and d normalized normal vectors
-    vector<double> map_waypoints_x;
-    vector<double> map_waypoints_y;
-    vector<double> map_waypoints_s;
-    vector<double> map_waypoints_dx;
-    vector<double> map_waypoints_dy;
+    // Trajectory generator: splines through anchor points (default), or --trajectory=jmt for quintic
+    // jerk-minimizing trajectories. --threads=N evaluates lane change candidates on N extra threads,
+    // 0 evaluates them on the main thread. --horizon=N sends N points to the simulator and
+    // --evaluation-horizon=N costs candidates over N points. --deadline=MS answers every frame within
+    // MS milliseconds of receiving it, with the best candidate evaluated by then. The deadline is best
+    // effort: a candidate that was started is finished, and the chosen one is sent. --planner=lattice
+    // replaces the lane change states with a dense lattice of maneuvers scored every frame.
+    // --trajectory=primitives follows motion primitives looked up in the library --primitives=PATH that
+    // primitive_compiler writes.
+    bool use_jmt = false;
+    bool use_primitives = false;
+    string primitives_file = "motion_primitives.bin";
+    bool use_lattice = false;
+    int threads = max(int(thread::hardware_concurrency()) - 1, 0);
+    TrajectoryHorizon horizon;
+    double deadline_ms = 0.0;
+    for (int i = 1; i < argc; i ++){
+        string arg = argv[i];
+        if (arg == "--trajectory=jmt") {
+            use_jmt = true;
+            use_primitives = false;
+        } else if (arg == "--trajectory=spline") {
+            use_jmt = false;
+            use_primitives = false;
+        } else if (arg == "--trajectory=primitives") {
+            use_jmt = false;
+            use_primitives = true;
+        } else if (arg.compare(0, 13, "--primitives=") == 0)
+            primitives_file = arg.substr(13);
+        else if (arg.compare(0, 10, "--threads=") == 0)
+            threads = atoi(arg.c_str() + 10);
+        else if (arg.compare(0, 10, "--horizon=") == 0)
+            horizon.output = atoi(arg.c_str() + 10);
+        else if (arg.compare(0, 21, "--evaluation-horizon=") == 0)
+            horizon.evaluation = atoi(arg.c_str() + 21);
+        else if (arg == "--planner=lattice")
+            use_lattice = true;
+        else if (arg == "--planner=states")
+            use_lattice = false;
+        else if (arg.compare(0, 11, "--deadline=") == 0)
+            deadline_ms = atof(arg.c_str() + 11);
+        else {
+            cerr << "Unknown argument " << arg << ", usage: path_planning [--trajectory=spline|jmt|primitives] [--threads=N]"
+                 << " [--primitives=PATH] [--horizon=N] [--evaluation-horizon=N] [--deadline=MS] [--planner=states|lattice]" << endl;
+            return -1;
+        }
+    }
 
-    // Waypoint map to read from
+    // the chosen candidate is sent, so it has to be at least as long as the output. getTrajectoryReadings() has
+    // no readings for fewer than 6 points, the cost function needs at least one.
+    if (horizon.output < 2 || horizon.output > horizon.evaluation || horizon.evaluation < 6 ||
+        horizon.evaluation > max_trajectory_points) {
+        cerr << "Horizons must satisfy 2 <= horizon <= evaluation horizon, 6 <= evaluation horizon <= "
+             << max_trajectory_points << endl;
+        return -1;
+    }
+    cout << "Generating " << (use_jmt ? "jerk-minimizing" : use_primitives ? "motion primitive" : "spline") << " trajectories" << endl;
+
+    // Primitives are mapped from the compiled library, not solved here
+    PrimitiveLibrary primitives;
+    if (use_primitives) {
+        if (!primitives.load(primitives_file)) {
+            cerr << "Failed to read motion primitives from " << primitives_file << ", run primitive_compiler to write them" << endl;
+            return -1;
+        }
+        cout << "Following " << primitives.grid().size() << " motion primitives from " << primitives_file << endl;
+    }
+    if (use_lattice)
+        cout << "Planning on a lattice of " << LatticeConfig().candidates() << " maneuvers" << endl;
+    if (deadline_ms > 0)
+        cout << "Answering every frame within " << deadline_ms << "ms" << endl;
+
+    // Follow a smooth spline through the waypoints instead of the straight segments between them, and
+    // resample the reference line for getXY(), see map_benchmark for the error at other spacings
+    double map_resample_ds = 0.5;
+    auto prepareMap = [map_resample_ds](HighwayMap &map, const string &map_file) {
+        if (!map.fitSpline())
+            cerr << "Failed to fit a spline to " << map_file << ", using the waypoint segments" << endl;
+        map.resample(map_resample_ds);
+
+        HighwayMap::ResampleStats resample_stats = map.resampleStats();
+        cout << "Reference line resampled every " << resample_stats.ds << "m: " << resample_stats.samples << " samples, "
+             << resample_stats.bytes / 1024 << " kB, max error " << resample_stats.max_error << "m" << endl;
+    };
+
+    // Load up map values for waypoint's x,y,s and d normalized normal vectors, and derive the per-segment tables.
+    // Every telemetry frame plans on a snapshot of the current map.
+    MapReloader maps([&prepareMap](HighwayMap &map, const string &map_file) {
+        if (!map.load(map_file))
+            return false;
+        prepareMap(map, map_file);
+        return true;
+    });
+
+#ifdef EMBED_MAP
+    // Waypoint map compiled into the executable from highway_map_bosch1.csv
+    string map_file_ = "embedded highway_map_bosch1.csv";
+    shared_ptr<HighwayMap> map(new HighwayMap);
+    if (!map->attach(embedded_map::kMap)) {
+        cerr << "Failed to attach map " << map_file_ << endl;
+        return -1;
+    }
+    prepareMap(*map, map_file_);
+    maps.publish(map);
+#else
+    // Waypoint map to read from, the compiled map from tools/map_compiler if there is one
     string map_file_ = "../highway_map_bosch1.csv";
-    // The max s value before wrapping around the track back to 0
-//    double max_s = 6945.554;
+    if (isCompiledMap("../highway_map_bosch1.bin"))
+        map_file_ = "../highway_map_bosch1.bin";
 
-    ifstream in_map_(map_file_.c_str(), ifstream::in);
-
-    string line;
-    while (getline(in_map_, line)) {
-        istringstream iss(line);
-        double x;
-        double y;
-        float s;
-        float d_x;
-        float d_y;
-        iss >> x;
-        iss >> y;
-        iss >> s;
-        iss >> d_x;
-        iss >> d_y;
-        map_waypoints_x.push_back(x);
-        map_waypoints_y.push_back(y);
-        map_waypoints_s.push_back(s);
-        map_waypoints_dx.push_back(d_x);
-        map_waypoints_dy.push_back(d_y);
+    if (!maps.load(map_file_)) {
+        cerr << "Failed to read map " << map_file_ << endl;
+        return -1;
     }
 
+    // Pick up edits of the map file without restarting the server
+    maps.watch();
+#endif
+    // The max s value before wrapping around the track back to 0
+//    double max_s = 6945.554;
+
     double ref_v = 0.0;
     struct Ego ego;
     ego.state = "START";
     ego.goal_lane = 1;
     ego.goal_s = 0.0;
 
-    h.onMessage([&ref_v, &map_waypoints_x, &map_waypoints_y, &map_waypoints_s, &map_waypoints_dx, &map_waypoints_dy, &ego](
+    // Spline the ego's trajectories continue along while it cruises
+    SplinePlan plan;
+
+    // Memory for the data of one telemetry frame
+    TickArena arena;
+
+    // Workers for the lane change candidates, each fits its candidate splines in its own plan and
+    // allocates from its own arena
+    CandidatePool candidate_pool(threads);
+    PerWorker<CandidateScratch> candidate_scratch(candidate_pool.workers());
+    cout << "Evaluating candidates on " << candidate_pool.workers() << " threads" << endl;
+
+    DeadlineStats deadline_stats;
+
+    // Maneuvers of the lattice planner
+    LatticePlanner lattice;
+
+    // Motion primitive the ego follows
+    PrimitivePlan primitive_plan;
+
+    // Map the plans above were made on
+    MapReloader::Snapshot planned_map;
+
+    h.onMessage([&ref_v, &maps, &ego, &plan, &arena, &candidate_pool, &candidate_scratch, &deadline_stats,
+                 &lattice, &primitives, &primitive_plan, &planned_map, use_jmt, use_primitives, use_lattice, horizon,
+                 deadline_ms](
             uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
             uWS::OpCode opCode) {
+
+        // the deadline of the anytime mode counts from here
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double, milli>(deadline_ms));
+
         // "42" at the start of the message means there's a websocket message event.
         // The 4 signifies a websocket message
         // The 2 signifies a websocket event
@@ -596,6 +1080,10 @@ int main() {
                 if (event == "telemetry") {
                     // j[1] is the data JSON object
 
+                    // Map for this frame, a reload in the meantime only affects the next one
+                    MapReloader::Snapshot map_snapshot = maps.current();
+                    const HighwayMap &map = *map_snapshot;
+
                     // Main car's localization Data
                     double car_x = j[1]["x"];
                     double car_y = j[1]["y"];
@@ -606,6 +1094,16 @@ int main() {
                     double car_yaw = j[1]["yaw"]; // in degrees
                     double car_speed = j[1]["speed"]; //mph
 
+                    // the plans and the goal of a lane change are in s of the previous map, start over on a new one
+                    if (map_snapshot != planned_map) {
+                        if (planned_map) {
+                            plan.valid = false;
+                            primitive_plan.valid = false;
+                            ego.goal_s = car_s0;
+                        }
+                        planned_map = map_snapshot;
+                    }
+
 
                     // Previous path data given to the Planner
                     auto previous_path_x = j[1]["previous_path_x"];
@@ -701,8 +1199,9 @@ int main() {
 
                     ref_v = max(min(ref_v, max_speed), min_speed);
 
-                    vector<double> ptsx;
-                    vector<double> ptsy;
+                    // Everything planned for this frame comes from the arenas, they are reset once it is answered
+                    TrajectoryBuffer prev_path;
+                    prev_path.allocate(arena, max(prev_size, 2));
 
                     // makes sure that previous_path has 2 points at least
                     if(prev_size < 2){
@@ -711,21 +1210,62 @@ int main() {
                         double prev_car_x = car_x - cos(deg2rad(car_yaw)) ;
                         double prev_car_y = car_y - sin(deg2rad(car_yaw));
 
-                        ptsx.push_back(prev_car_x);
-                        ptsx.push_back(car_x);
-
-                        ptsy.push_back(prev_car_y);
-                        ptsy.push_back(car_y);
-
-                        previous_path_x = ptsx;
-                        previous_path_y = ptsy;
+                        prev_path.push_back(prev_car_x, prev_car_y);
+                        prev_path.push_back(car_x, car_y);
 
+                    } else {
+                        for (int i = 0; i < prev_size; i ++)
+                            prev_path.push_back(previous_path_x[i], previous_path_y[i]);
                     }
 
+                    int cars = sensor_fusion.size();
+                    FusionCar *fusion = arena.allocate<FusionCar>(cars);
+                    for (int c = 0; c < cars; c ++)
+                        for (int k = 0; k < 7; k ++)
+                            fusion[c][k] = sensor_fusion[c][k];
+
                     // Generate trajectory
-                    vector<vector<double>> trajectory;
+                    TrajectoryBuffer trajectory;
+
+                    // primitive candidates continue the plan of the last frame, not the kept lane one
+                    PrimitivePlan last_primitive = primitive_plan;
+
+                    // trajectory in the ego's goal lane, spline trajectories continue the last plan when they can. It is
+                    // only sent, so it ends at the output horizon.
+                    auto planTrajectory = [&]() {
+                        if (use_jmt)
+                            generateTrajectoryJMT(car_s, prev_path, ref_v, ego.goal_lane, horizon.output, map, arena, trajectory);
+                        else if (use_primitives)
+                            generateTrajectoryPrimitive(car_s, prev_path, ref_v, ego.goal_lane, horizon.output, primitives, map,
+                                                        primitive_plan, arena, trajectory, primitive_plan);
+                        else
+                            generateTrajectory(car_s, prev_path, ref_v, ego.goal_lane, horizon.output, map, arena, trajectory, &plan);
+                    };
+
+                    // the kept lane trajectory if it was planned before the lane change candidates
+                    TrajectoryBuffer kept_lane;
+
+                    if (use_lattice) {
+
+                        LatticeCandidates candidates;
+                        int best = generateTrajectoryLattice(lattice, prev_path, ref_v, ego.goal_lane, horizon.output, fusion, cars,
+                                                             map, candidate_pool, candidate_scratch, arena, candidates, trajectory,
+                                                             deadline_ms > 0 ? &deadline : nullptr);
+
+                        // nothing on the lattice is safe, or nothing was scored in time: keep the lane at ref_v, which
+                        // slows down behind a car
+                        if (candidates.cost[best] >= reject_cost) {
+                            cout << "Lattice: no candidate below " << reject_cost << ", keeping lane " << cur_lane << endl;
+                            ego.goal_lane = cur_lane;
+                            goto KL;
+                        }
+
+                        int lane, speed, duration;
+                        lattice.split(best, lane, speed, duration);
+                        ego.goal_lane = lane;
+                        ego.state = lane == cur_lane ? "KL" : lane < cur_lane ? "LCL" : "LCR";
 
-                    if (ego.state == "LCL") {
+                    } else if (ego.state == "LCL") {
 
                         if (abs(ego.goal_lane * 4 + 2 - car_d) < 1.0 && car_s0 - ego.goal_s > 30.0){
                             cout << "LCL completed" << endl;
@@ -733,8 +1273,7 @@ int main() {
                             goto KL;
                         }
                         else{
-                            trajectory = generateTrajectory({car_s, car_d}, previous_path_x, previous_path_y, ref_v, ego.goal_lane,
-                                                            map_waypoints_s, map_waypoints_x, map_waypoints_y);
+                            planTrajectory();
                         }
                     } else if (ego.state == "LCR") {
 
@@ -744,46 +1283,152 @@ int main() {
                             goto KL;
                         }
                         else{
-                            trajectory = generateTrajectory({car_s, car_d}, previous_path_x, previous_path_y, ref_v, ego.goal_lane,
-                                                            map_waypoints_s, map_waypoints_x, map_waypoints_y);
+                            planTrajectory();
                         }
                     } else if (car_speed < 45 && (too_close_ahead) && (check_car_ahead_vs < 45.0/2.24)  && (!maybe_bump)) {
 
                         cout << "Choosing ..." << endl;
-                        vector<vector<double>> anchors;
+
+                        // in the anytime mode the lane is kept unless a candidate is found in time, so that
+                        // trajectory is ready before the candidates are evaluated
+                        if (deadline_ms > 0) {
+                            planTrajectory();
+                            kept_lane = trajectory;
+                        }
+
+                        TrajectoryBuffer anchors;
                         int anchor_lane = -1;
-                        vector<double> costs;
                         double cost = 9999;
 
                         // generate anchors
-                        anchors = generateAnchors(car_s, sensor_fusion, cur_lane, car_speed/2.24, car_s0);
+                        generateAnchors(car_s, fusion, cars, cur_lane, car_speed/2.24, car_s0, arena, anchors);
+                        int candidates = anchors.size;
+
+                        int *anchor_lanes = arena.allocate<int>(candidates);
+                        for (int a = 0; a < candidates; a++)
+                            anchor_lanes[a] = calculateLane(anchors.d[a]);
+
+                        // a candidate that costs reject_cost or more is never taken, so the ones into a goal lane that is
+                        // rejected from the first reading all candidates share are not evaluated at all.
+                        // The s,d of the previous path points are the same for every candidate, so they are taken once. That
+                        // is all that is shared, candidates are not reused across frames: ref_v and the anchors move with the
+                        // traffic, so almost no candidate repeats an earlier frame's.
+                        // Each candidate's new points continue from a copy of the cursor left at the end of them.
+                        int prev_points = prev_path.size;
+                        double *prefix_theta = arena.allocate<double>(prev_points-1);
+                        double *prefix_s = arena.allocate<double>(prev_points-1), *prefix_d = arena.allocate<double>(prev_points-1);
+                        for (int i = 1; i < prev_points; i ++)
+                            prefix_theta[i-1] = atan2(prev_path.y[i] - prev_path.y[i-1], prev_path.x[i] - prev_path.x[i-1]);
+                        FrenetCursor prefix_end(map);
+                        prefix_end.getFrenetBatch(&prev_path.x[1], &prev_path.y[1], prefix_theta, prev_points-1, prefix_s, prefix_d);
+
+                        bool lane_rejected[3];
+                        for (int l = 0; l < 3; l++)
+                            lane_rejected[l] = laneRejected(prefix_s[0], prefix_d[0], fusion, cars, cur_lane, l, check_car_ahead_vs, check_car_ahead_s0);
+
+                        int *order = arena.allocate<int>(candidates);
+                        int *order_lanes = arena.allocate<int>(candidates);
+                        int live = 0;
+                        for (int a = 0; a < candidates; a++)
+                            if (!lane_rejected[anchor_lanes[a]])
+                                order[live++] = a;
+                        for (int k = 0; k < live; k++)
+                            order_lanes[k] = anchor_lanes[order[k]];
+                        cout << live << " of " << candidates << " candidates left in lanes not rejected" << endl;
+
+                        // jerk-minimizing trajectories for all remaining anchors in one batch, with their readings. One
+                        // that is the same as an earlier one is not costed again.
+                        TrajectoryBuffer *temp_trajectories = arena.allocate<TrajectoryBuffer>(live);
+                        TrajectoryReadings *temp_readings = arena.allocate<TrajectoryReadings>(live);
+                        int *same_as = arena.allocate<int>(live);
+                        int jmt_generated = 0;
+                        if (use_jmt && live > 0) {
+                            double *order_s = arena.allocate<double>(live);
+                            for (int k = 0; k < live; k++)
+                                order_s[k] = anchors.s[order[k]];
+                            jmt_generated = generateTrajectoriesJMT(order_s, order_lanes, live, prev_path, ref_v, horizon.evaluation,
+                                                                    map, arena, temp_trajectories, temp_readings, same_as,
+                                                                    deadline_ms > 0 ? &deadline : nullptr);
+                        }
 
-                        // generate trajectory for each anchor and evaluate them based on cost function
-                        for (auto anchor: anchors) {
+                        // generate trajectory for each anchor and evaluate them based on cost function, concurrently. In
+                        // the anytime mode the ones not started (or not generated in the batch) by the deadline are
+                        // dropped, they come last in the order. What a candidate logs is printed after all are done.
+                        double *costs = arena.allocate<double>(live);
+                        vector<string> candidate_log(live);
+                        atomic<int> dropped(0);
 
-                            vector<vector<double>> temp_trajectory;
-                            int temp_lane = calculateLane(anchor[1]);
+                        candidate_pool.run(live, [&](int k, int worker) {
 
-                            temp_trajectory = generateTrajectory(anchor, previous_path_x, previous_path_y, ref_v, temp_lane,
-                                                                 map_waypoints_s, map_waypoints_x, map_waypoints_y);
+                            CandidateScratch &scratch = candidate_scratch[worker];
+                            int a = order[k];
+                            int temp_lane = order_lanes[k];
 
-                            vector<vector<double>> ego_readings;
-                            ego_readings = getTrajectoryReadings(temp_trajectory, map_waypoints_x, map_waypoints_y);
+                            if ((deadline_ms > 0 && chrono::steady_clock::now() >= deadline) || (use_jmt && k >= jmt_generated)) {
+                                costs[k] = numeric_limits<double>::infinity();
+                                dropped++;
+                                return;
+                            }
 
-                            double temp_cost = calculateCost(temp_trajectory, ego_readings, sensor_fusion, cur_lane,
-                                                             temp_lane, check_car_ahead_vs, check_car_ahead_s0);
+                            if (use_jmt && same_as[k] >= 0) {
+                                costs[k] = numeric_limits<double>::infinity();
+                                return;
+                            }
 
-                            costs.push_back(temp_cost);
+                            if (use_primitives) {
+                                if (!generateTrajectoryPrimitive(anchors.s[a], prev_path, ref_v, temp_lane, horizon.evaluation, primitives,
+                                                                 map, last_primitive, scratch.arena, temp_trajectories[k],
+                                                                 scratch.primitive_plan)) {
+                                    costs[k] = numeric_limits<double>::infinity();
+                                    return;
+                                }
+                                getTrajectoryReadings(temp_trajectories[k], map, scratch.arena, temp_readings[k], prefix_s, prefix_d,
+                                                      prev_points-1, &prefix_end);
+                            } else if (!use_jmt)
+                                evaluateSplineCandidate(anchors.s[a], prev_path, prefix_s, prefix_d, prefix_end, ref_v, temp_lane, horizon.evaluation,
+                                                        map, scratch, temp_trajectories[k], temp_readings[k]);
+
+                            ostringstream out;
+                            costs[k] = calculateCost(temp_trajectories[k], temp_readings[k], fusion, cars, cur_lane,
+                                                     temp_lane, check_car_ahead_vs, check_car_ahead_s0, scratch.arena, out);
+                            candidate_log[k] = out.str();
+                        });
+                        for (int k = 0; k < live; k++)
+                            cout << candidate_log[k];
+
+                        // pick the first cheapest candidate in anchor order, like the serial loop did. A skipped duplicate
+                        // costs the same as the earlier candidate it repeats, so it would not have been picked either.
+                        int chosen = candidates;
+                        for (int k = 0; k < live; k++) {
+
+                            if (costs[k] < cost || (costs[k] == cost && order[k] < chosen)){
+                                cost = costs[k];
+                                chosen = order[k];
+                                trajectory = temp_trajectories[k];
+                                anchor_lane = order_lanes[k];
+                                ego.goal_s = temp_readings[k].s[temp_readings[k].size-1];
+                            }
+                        }
 
-                            if (temp_cost < cost){
-                                cost = temp_cost;
-                                trajectory = temp_trajectory;
-                                anchor_lane = calculateLane(anchor[1]);
-                                ego.goal_s = ego_readings[0][ego_readings[0].size()-1];
+                        // the primitive to drive is placed again so the plan keeps its points
+                        if (use_primitives && cost < reject_cost)
+                            generateTrajectoryPrimitive(anchors.s[chosen], prev_path, ref_v, anchor_lane, horizon.output, primitives, map,
+                                                        last_primitive, arena, trajectory, primitive_plan);
+
+                        if (deadline_ms > 0) {
+                            deadline_stats.candidates += live;
+                            deadline_stats.dropped += dropped.load();
+                            if (dropped.load() > 0) {
+                                deadline_stats.hits++;
+                                cout << dropped.load() << " of " << live << " candidates dropped at the deadline" << endl;
                             }
                         }
 
-                        if (cost >= 10) {
+                        // a lane change does not continue the plan the kept lane trajectory was planned on
+                        if (!kept_lane.empty() && cost < reject_cost)
+                            plan.valid = false;
+
+                        if (cost >= reject_cost) {
                             goto KL;
                         }else if (anchor_lane < cur_lane){
                             ego.state = "PLCL";
@@ -802,8 +1447,10 @@ int main() {
                     } else {
                         KL:
                         ego.state = "KL";
-                        trajectory = generateTrajectory({car_s, car_d}, previous_path_x, previous_path_y, ref_v, ego.goal_lane,
-                                                        map_waypoints_s, map_waypoints_x, map_waypoints_y);
+                        if (kept_lane.empty())
+                            planTrajectory();
+                        else
+                            trajectory = kept_lane;
                     }
 
                     if (ego_.state != ego.state)
@@ -811,9 +1458,9 @@ int main() {
 
                     // TODO: end
 
-                    for (int i = 0; i < 50; i ++){
-                        next_x_vals.push_back(trajectory[i][0]);
-                        next_y_vals.push_back(trajectory[i][1]);
+                    for (int i = 0; i < horizon.output; i ++){
+                        next_x_vals.push_back(trajectory.x[i]);
+                        next_y_vals.push_back(trajectory.y[i]);
                     }
 
                     msgJson["next_x"] = next_x_vals;
@@ -824,6 +1471,24 @@ int main() {
                     //this_thread::sleep_for(chrono::milliseconds(1000));
                     ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
 
+                    if (deadline_ms > 0) {
+                        double slack = chrono::duration<double, milli>(deadline - chrono::steady_clock::now()).count();
+                        DeadlineStats &stats = deadline_stats;
+                        stats.frames++;
+                        stats.overruns += slack < 0;
+                        stats.slack_sum += slack;
+                        stats.slack_min = min(stats.slack_min, slack);
+                        if (stats.frames % 500 == 0)
+                            cout << "Deadline " << deadline_ms << "ms: " << stats.frames << " frames, " << stats.hits << " hits, "
+                                 << stats.overruns << " overruns, " << stats.dropped << " of " << stats.candidates
+                                 << " candidates dropped, slack mean " << stats.slack_sum / stats.frames << "ms min "
+                                 << stats.slack_min << "ms" << endl;
+                    }
+
+                    arena.reset();
+                    for (int w = 0; w < candidate_pool.workers(); w ++)
+                        candidate_scratch[w].arena.reset();
+
                 }
             } else {
                 // Manual driving
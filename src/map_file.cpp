@@ -0,0 +1,83 @@
+#include "map_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+bool isCompiledMap(const string &path) {
+
+    ifstream in(path.c_str(), ifstream::in | ifstream::binary);
+    char magic[sizeof(kMapFileMagic)];
+    if (!in.read(magic, sizeof(magic)))
+        return false;
+
+    return memcmp(magic, kMapFileMagic, sizeof(magic)) == 0;
+}
+
+bool replaceFile(const string &path, const vector<FileChunk> &chunks) {
+
+    // in the same directory, rename() does not move files across file systems
+    ostringstream temp;
+    temp << path << ".tmp" << getpid();
+    string temp_path = temp.str();
+
+    bool written;
+    {
+        ofstream out(temp_path.c_str(), ofstream::out | ofstream::binary | ofstream::trunc);
+        for (size_t i = 0; i < chunks.size(); i++)
+            out.write(static_cast<const char *>(chunks[i].data), chunks[i].size);
+        out.close();
+        written = bool(out);
+    }
+
+    if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::open(const string &path) {
+
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (addr == MAP_FAILED)
+        return false;
+
+    data_ = static_cast<const char *>(addr);
+    size_ = st.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+
+    if (data_)
+        munmap(const_cast<char *>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+void MappedFile::swap(MappedFile &other) {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+}
@@ -0,0 +1,87 @@
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Compiled map file, written by tools/map_compiler and read by HighwayMap::load().
+//
+// The file is the header below followed by the HighwayMap tables exactly as they are used
+// in memory, so loading it is a memory mapping plus a few checks:
+//   tables_offset  waypoints doubles per table, in HighwayMap's table order
+//   grid_offset    grid_cols * grid_rows + 1 cell starts, then waypoints cell items (int32)
+// Values are stored in the byte order of the machine that compiled the map, a reader with a
+// different byte order or version rejects the file.
+const char kMapFileMagic[8] = {'H', 'W', 'Y', 'M', 'A', 'P', '\0', '\0'};
+const uint32_t kMapFileVersion = 1;
+const uint32_t kMapFileByteOrder = 0x01020304;
+
+struct MapFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t waypoints;
+    uint32_t tables;
+    uint32_t grid_cols;
+    uint32_t grid_rows;
+    double grid_cell;
+    double grid_min_x;
+    double grid_min_y;
+    uint64_t tables_offset;
+    uint64_t grid_offset;
+    uint64_t file_size;
+};
+
+// The HighwayMap tables wherever they are stored: in memory, in a mapped compiled map file or
+// compiled into the executable (EMBED_MAP, see tools/map_compiler --header)
+struct MapTables {
+    int waypoints;
+    int tables;
+    const double *table_block;  // tables * waypoints doubles
+    int grid_cols;
+    int grid_rows;
+    double grid_cell;
+    double grid_min_x;
+    double grid_min_y;
+    const int32_t *grid_start;  // grid_cols * grid_rows + 1 cell starts
+    const int32_t *grid_items;  // waypoints cell items
+};
+
+// True if the file starts with the compiled map magic
+bool isCompiledMap(const std::string &path);
+
+// Piece of a file to write with replaceFile()
+struct FileChunk {
+    const void *data;
+    size_t size;
+};
+
+// Writes the chunks to a temporary file next to path and renames it over path. Readers open either
+// the old file or the complete new one, and mappings of the old file keep their contents, where
+// truncating a mapped file in place makes reading the mapping fault with SIGBUS.
+bool replaceFile(const std::string &path, const std::vector<FileChunk> &chunks);
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile(): data_(nullptr), size_(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &path);
+    void close();
+    void swap(MappedFile &other);
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    const char *data_;
+    size_t size_;
+};
+
+#endif /* MAP_FILE_H */
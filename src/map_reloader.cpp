@@ -0,0 +1,96 @@
+#include "map_reloader.h"
+
+#include <sys/stat.h>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+MapReloader::MapReloader(Loader loader): loader_(loader), reloads_(0), stop_(false) {
+    FileStamp none = {0, 0, -1, 0};
+    file_stamp_ = pending_stamp_ = failed_stamp_ = none;
+}
+
+MapReloader::~MapReloader() {
+    stop();
+}
+
+bool MapReloader::stamp(const string &map_file, FileStamp &file_stamp) {
+
+    struct stat st;
+    if (stat(map_file.c_str(), &st) != 0)
+        return false;
+
+    file_stamp.mtime_sec = st.st_mtim.tv_sec;
+    file_stamp.mtime_nsec = st.st_mtim.tv_nsec;
+    file_stamp.size = st.st_size;
+    file_stamp.inode = st.st_ino;
+    return true;
+}
+
+bool MapReloader::load(const string &map_file) {
+
+    // a write during the load changes the stamp, the map read is then discarded
+    FileStamp file_stamp, after;
+    if (!stamp(map_file, file_stamp))
+        return false;
+
+    shared_ptr<HighwayMap> map(new HighwayMap);
+    if (!loader_(*map, map_file) || !stamp(map_file, after) || !(after == file_stamp))
+        return false;
+
+    map_file_ = map_file;
+    file_stamp_ = file_stamp;
+    publish(map);
+    return true;
+}
+
+void MapReloader::publish(Snapshot map) {
+    atomic_store(&current_, map);
+}
+
+void MapReloader::watch(int poll_ms) {
+
+    stop();
+    stop_ = false;
+    watcher_ = thread(&MapReloader::run, this, poll_ms);
+}
+
+void MapReloader::stop() {
+
+    if (!watcher_.joinable())
+        return;
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    watcher_.join();
+}
+
+void MapReloader::run(int poll_ms) {
+
+    unique_lock<mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, chrono::milliseconds(poll_ms), [this] { return stop_; })) {
+
+        FileStamp file_stamp;
+        if (!stamp(map_file_, file_stamp) || file_stamp == file_stamp_)
+            continue;
+
+        // a writer still at work changes the stamp again, wait until it holds for one poll
+        if (!(file_stamp == pending_stamp_)) {
+            pending_stamp_ = file_stamp;
+            continue;
+        }
+
+        // a file that fails to load is tried again at every poll, until it loads or changes
+        if (load(map_file_)) {
+            reloads_++;
+            cout << "Reloaded map " << map_file_ << endl;
+        } else if (!(file_stamp == failed_stamp_)) {
+            cerr << "Failed to reload map " << map_file_ << ", keeping the current one" << endl;
+            failed_stamp_ = file_stamp;
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef MAP_RELOADER_H
+#define MAP_RELOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "highway_map.h"
+
+// Current map of the planner, reloaded in the background when its file changes.
+//
+// Readers take a snapshot with current() at the start of a telemetry frame and plan the whole
+// frame on it. A reload builds the new map on the watcher thread and publishes it with an atomic
+// pointer swap, readers never wait for it. The old map is freed once the last frame holding a
+// snapshot of it is done.
+class MapReloader {
+public:
+    typedef std::shared_ptr<const HighwayMap> Snapshot;
+
+    // Loads a map file into a new map, e.g. HighwayMap::load() plus fitSpline() and resample()
+    typedef std::function<bool(HighwayMap &map, const std::string &map_file)> Loader;
+
+    explicit MapReloader(Loader loader);
+    ~MapReloader();
+
+    // Load the map file now, returns false if the loader fails
+    bool load(const std::string &map_file);
+
+    // Publish a map that was built elsewhere, e.g. the embedded one. Planner state derived from the
+    // previous map has to be dropped by the reader when current() returns a different snapshot.
+    void publish(Snapshot map);
+
+    // Check the last loaded map file for changes every poll_ms and reload it
+    void watch(int poll_ms = 500);
+    void stop();
+
+    Snapshot current() const { return std::atomic_load(&current_); }
+    int reloads() const { return reloads_; }
+
+private:
+    MapReloader(const MapReloader &);
+    MapReloader &operator=(const MapReloader &);
+
+    // Modification time to the nanosecond, size and inode, a file replaced by rename() is a new inode
+    struct FileStamp {
+        long long mtime_sec;
+        long mtime_nsec;
+        long long size;
+        unsigned long long inode;
+        bool operator==(const FileStamp &other) const {
+            return mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec && size == other.size &&
+                   inode == other.inode;
+        }
+    };
+    static bool stamp(const std::string &map_file, FileStamp &file_stamp);
+
+    void run(int poll_ms);
+
+    Loader loader_;
+    std::string map_file_;
+    FileStamp file_stamp_;     // of the loaded map
+    FileStamp pending_stamp_;  // seen at the last poll
+    FileStamp failed_stamp_;   // of the last failed reload, reported once
+    Snapshot current_;
+    std::atomic<int> reloads_;
+
+    std::thread watcher_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_;
+};
+
+#endif /* MAP_RELOADER_H */
@@ -0,0 +1,196 @@
+#include "primitive_library.h"
+
+#include <math.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// samples per primitive when it is validated
+const int kValidationSamples = 400;
+
+// Range of v0 over which s(t) = v0 t + shape_s(t), d(t) never backs up and stays within the speed limit,
+// and the peak acceleration and jerk, sampled over the maneuver. Past it the end speed is held.
+void validate(const Quintic &shape_s, const Quintic &shape_d, double T, double speed_limit, MotionPrimitive &p) {
+
+    double v0_min = 0.0, v0_max = speed_limit;
+    double a_max = 0.0, j_max = 0.0;
+    for (int k = 0; k <= kValidationSamples; k++) {
+        double t = T * k / kValidationSamples;
+        double vs = shape_s.deriv(t, 1), vd = shape_d.deriv(t, 1);
+        double as = shape_s.deriv(t, 2), ad = shape_d.deriv(t, 2);
+        double js = shape_s.deriv(t, 3), jd = shape_d.deriv(t, 3);
+
+        // s'(t) = v0 + vs >= 0 and (v0 + vs)^2 + vd^2 <= speed_limit^2
+        v0_min = max(v0_min, -vs);
+        v0_max = vd * vd < speed_limit * speed_limit ? min(v0_max, sqrt(speed_limit * speed_limit - vd * vd) - vs) : -1.0;
+
+        a_max = max(a_max, sqrt(as * as + ad * ad));
+        j_max = max(j_max, sqrt(js * js + jd * jd));
+    }
+
+    // rounded inwards, the range is stored as floats
+    p.v0_min = float(v0_min);
+    p.v0_max = float(v0_max);
+    if (p.v0_min < v0_min)
+        p.v0_min = nextafterf(p.v0_min, numeric_limits<float>::infinity());
+    if (p.v0_max > v0_max)
+        p.v0_max = nextafterf(p.v0_max, -numeric_limits<float>::infinity());
+    p.a_max = a_max;
+    p.j_max = j_max;
+}
+
+}
+
+void PrimitiveLibrary::build(const PrimitiveGrid &grid) {
+
+    grid_ = grid;
+    grid_.lanes = max(grid_.lanes, 0);
+    grid_.speed_changes = max(grid_.speed_changes, 1);
+    grid_.durations = max(grid_.durations, 1);
+
+    built_.assign(grid_.size(), MotionPrimitive());
+    file_.close();
+    primitives_ = built_.data();
+
+    const JMTState rest = {0.0, 0.0, 0.0};
+    for (int l = -grid_.lanes; l <= grid_.lanes; l++) {
+        for (int v = 0; v < grid_.speed_changes; v++) {
+            for (int m = 0; m < grid_.durations; m++) {
+
+                // shape_s is what s(t) adds to v0 t, a speed change of dv over distance T dv / 2
+                double T = duration(m), dv = speedChange(v);
+                JMTState end_s = {T * dv / 2, dv, 0.0};
+                JMTState end_d = {l * grid_.lane_width, 0.0, 0.0};
+                Quintic shape_s = solveJMT(rest, end_s, T);
+                Quintic shape_d = solveJMT(rest, end_d, T);
+
+                MotionPrimitive &p = built_[((l + grid_.lanes) * grid_.speed_changes + v) * grid_.durations + m];
+                copy(shape_s.c + 3, shape_s.c + 6, p.s);
+                copy(shape_d.c + 3, shape_d.c + 6, p.d);
+                validate(shape_s, shape_d, T, grid_.speed_limit, p);
+
+                // over the limits, valid for no v0
+                if (p.a_max > grid_.margin * grid_.accel_limit || p.j_max > grid_.margin * grid_.jerk_limit) {
+                    p.v0_min = 1.0;
+                    p.v0_max = 0.0;
+                }
+            }
+        }
+    }
+}
+
+bool PrimitiveLibrary::save(const string &path) const {
+
+    if (empty())
+        return false;
+
+    // zeroed with the padding, the grid is plain data
+    PrimitiveFileHeader header;
+    memset(static_cast<void *>(&header), 0, sizeof(header));
+    memcpy(header.magic, kPrimitiveFileMagic, sizeof(kPrimitiveFileMagic));
+    header.version = kPrimitiveFileVersion;
+    header.byte_order = kMapFileByteOrder;
+    header.primitives = grid_.size();
+    header.primitive_size = sizeof(MotionPrimitive);
+    header.grid = grid_;
+    header.primitives_offset = (sizeof(header) + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+    header.file_size = header.primitives_offset + uint64_t(header.primitives) * sizeof(MotionPrimitive);
+
+    // the primitives may be mapped from path itself, which is replaced rather than rewritten
+    vector<char> padding(header.primitives_offset - sizeof(header), 0);
+    vector<FileChunk> chunks = {
+            {&header, sizeof(header)},
+            {padding.data(), padding.size()},
+            {primitives_, uint64_t(header.primitives) * sizeof(MotionPrimitive)}};
+    return replaceFile(path, chunks);
+}
+
+bool PrimitiveLibrary::load(const string &path) {
+
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(PrimitiveFileHeader))
+        return false;
+
+    PrimitiveFileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    const PrimitiveGrid &grid = header.grid;
+    bool valid = memcmp(header.magic, kPrimitiveFileMagic, sizeof(kPrimitiveFileMagic)) == 0 &&
+                 header.version == kPrimitiveFileVersion &&
+                 header.byte_order == kMapFileByteOrder &&
+                 header.primitive_size == sizeof(MotionPrimitive) &&
+                 grid.lanes >= 0 && grid.speed_changes > 0 && grid.durations > 0 &&
+                 header.primitives == uint32_t(grid.size()) &&
+                 header.file_size == file.size() &&
+                 header.primitives_offset % sizeof(double) == 0 &&
+                 header.primitives_offset + uint64_t(header.primitives) * sizeof(MotionPrimitive) <= header.file_size;
+    if (!valid)
+        return false;
+
+    grid_ = grid;
+    primitives_ = reinterpret_cast<const MotionPrimitive *>(file.data() + header.primitives_offset);
+    file_.swap(file);
+    vector<MotionPrimitive>().swap(built_);
+    return true;
+}
+
+const MotionPrimitive &PrimitiveLibrary::at(int lane_change, int speed_change, int duration) const {
+    return primitives_[((lane_change + grid_.lanes) * grid_.speed_changes + speed_change) * grid_.durations + duration];
+}
+
+double PrimitiveLibrary::speedChange(int speed_change) const {
+    if (grid_.speed_changes == 1)
+        return 0.0;
+    return -grid_.max_speed_change + speed_change * 2 * grid_.max_speed_change / (grid_.speed_changes - 1);
+}
+
+double PrimitiveLibrary::duration(int duration) const {
+    if (grid_.durations == 1)
+        return grid_.max_duration;
+    return grid_.min_duration + duration * (grid_.max_duration - grid_.min_duration) / (grid_.durations - 1);
+}
+
+int PrimitiveLibrary::speedChangeIndex(double dv) const {
+    if (grid_.speed_changes == 1)
+        return 0;
+    double step = 2 * grid_.max_speed_change / (grid_.speed_changes - 1);
+    int index = int(lround((dv + grid_.max_speed_change) / step));
+    return max(0, min(index, grid_.speed_changes - 1));
+}
+
+int PrimitiveLibrary::find(int lane_change, int speed_change, double v0, double duration_hint) const {
+
+    int best = -1;
+    double best_error = numeric_limits<double>::infinity();
+    for (int m = 0; m < grid_.durations; m++) {
+        if (!at(lane_change, speed_change, m).valid(v0))
+            continue;
+        if (duration_hint <= 0)
+            return m;
+        double error = abs(duration(m) - duration_hint);
+        if (error < best_error) {
+            best = m;
+            best_error = error;
+        }
+    }
+    return best;
+}
+
+void PrimitiveLibrary::place(int lane_change, int speed_change, int duration, double s0, double v0, double d0,
+                             Quintic &s, Quintic &d) const {
+
+    // the shapes start at rest at the origin, so placing them is a translation plus v0 t
+    const MotionPrimitive &p = at(lane_change, speed_change, duration);
+    s.c[0] = s0;
+    s.c[1] = v0;
+    s.c[2] = 0.0;
+    d.c[0] = d0;
+    d.c[1] = 0.0;
+    d.c[2] = 0.0;
+    copy(p.s, p.s + 3, s.c + 3);
+    copy(p.d, p.d + 3, d.c + 3);
+}
@@ -0,0 +1,112 @@
+#ifndef PRIMITIVE_LIBRARY_H
+#define PRIMITIVE_LIBRARY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "jmt.h"
+#include "map_file.h"
+#include "trajectory_buffer.h"
+
+// Library of motion primitives, written by tools/primitive_compiler and mapped by PrimitiveLibrary::load().
+//
+// A primitive is a jerk-minimizing change of lane and speed in Frenet coordinates from a steady state
+// (no acceleration, no lateral speed) to the next one in a given duration: s(t) = v0 t + shape_s(t),
+// d(t) = shape_d(t). The shapes do not depend on the initial speed v0, so the library stores one per
+// (lane change, speed change, duration), with the range of v0 over which the primitive stays within the
+// speed limit and never backs up. Its acceleration and jerk do not depend on v0 and are validated
+// offline, primitives over the limits are stored with an empty range.
+//
+// The file is the header below followed by the primitives, index
+// (lane_change * speed_changes + speed_change) * durations + duration, in the byte order of the machine
+// that compiled it.
+const char kPrimitiveFileMagic[8] = {'H', 'W', 'Y', 'P', 'R', 'I', 'M', '\0'};
+const uint32_t kPrimitiveFileVersion = 1;
+
+// Grid of a library and the limits it is validated against
+struct PrimitiveGrid {
+    // lane changes of up to lanes lanes either way
+    int lanes = 1;
+    double lane_width = 4.0;
+
+    // end speed minus start speed, evenly spaced, in m/s
+    int speed_changes = 41;
+    double max_speed_change = 5.0;
+
+    // maneuver durations, evenly spaced, in s
+    int durations = 15;
+    double min_duration = 0.5, max_duration = 4.0;
+
+    // acceleration and jerk are kept within margin times their limits, the Frenet shapes do not see the
+    // curvature of the road
+    double speed_limit = kSpeedLimit, accel_limit = kAccelLimit, jerk_limit = kJerkLimit;
+    double margin = 0.9;
+
+    int laneChanges() const { return 2 * lanes + 1; }
+    int size() const { return laneChanges() * speed_changes * durations; }
+};
+
+struct PrimitiveFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t primitives;
+    uint32_t primitive_size;
+    PrimitiveGrid grid;
+    uint64_t primitives_offset;
+    uint64_t file_size;
+};
+
+// c3..c5 of shape_s(t) and shape_d(t), the initial speeds it is valid for and its peak acceleration and jerk
+struct MotionPrimitive {
+    double s[3], d[3];
+    float v0_min, v0_max;
+    float a_max, j_max;
+
+    bool valid(double v0) const { return v0 >= v0_min && v0 <= v0_max; }
+};
+
+class PrimitiveLibrary {
+public:
+    PrimitiveLibrary(): primitives_(nullptr) {}
+
+    // Solve and validate every primitive of the grid
+    void build(const PrimitiveGrid &grid);
+
+    bool save(const std::string &path) const;
+
+    // Map a compiled library, false if the file is not one of this version and byte order
+    bool load(const std::string &path);
+
+    bool empty() const { return primitives_ == nullptr; }
+    bool mapped() const { return file_.data() != nullptr; }
+    const PrimitiveGrid &grid() const { return grid_; }
+
+    // lane_change from -grid().lanes, speed_change and duration from 0
+    const MotionPrimitive &at(int lane_change, int speed_change, int duration) const;
+
+    double speedChange(int speed_change) const;
+    double duration(int duration) const;
+
+    // Grid speed change closest to dv
+    int speedChangeIndex(double dv) const;
+
+    // Duration of the primitive valid for v0 whose duration is closest to duration_hint, the shortest one
+    // for a hint <= 0, -1 if there is none
+    int find(int lane_change, int speed_change, double v0, double duration_hint) const;
+
+    // s(t), d(t) of a primitive placed at s0, d0 with initial speed v0
+    void place(int lane_change, int speed_change, int duration, double s0, double v0, double d0,
+               Quintic &s, Quintic &d) const;
+
+private:
+    PrimitiveLibrary(const PrimitiveLibrary &);
+    PrimitiveLibrary &operator=(const PrimitiveLibrary &);
+
+    PrimitiveGrid grid_;
+    std::vector<MotionPrimitive> built_;
+    MappedFile file_;
+    const MotionPrimitive *primitives_;
+};
+
+#endif /* PRIMITIVE_LIBRARY_H */
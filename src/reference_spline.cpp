@@ -0,0 +1,187 @@
+#include "reference_spline.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <Eigen/SparseCore>
+#include <Eigen/SparseLU>
+
+using namespace std;
+
+bool ReferenceSpline::fit(const double *x, const double *y, const double *s, int n) {
+
+    const int degree = 3;
+    length_ = 0.0;
+    if (n <= degree || s[n - 1] <= s[0])
+        return false;
+
+    s0_ = s[0];
+    double length = s[n - 1] - s[0];
+
+    Spline2d::KnotVectorType params(n);
+    Eigen::MatrixXd pts(n, 2);
+    for (int i = 0; i < n; i++) {
+        params(i) = (s[i] - s0_) / length;
+        pts(i, 0) = x[i];
+        pts(i, 1) = y[i];
+    }
+    params(n - 1) = 1.0;
+
+    Spline2d::KnotVectorType knots;
+    Eigen::KnotAveraging(params, degree, knots);
+
+    // Same system as SplineFitting::Interpolate(), which builds it dense and solves it with QR.
+    // Only degree+1 basis functions are non-zero at each parameter, so solve it sparse instead.
+    vector<Eigen::Triplet<double> > entries;
+    entries.reserve(n * (degree + 1));
+    entries.push_back(Eigen::Triplet<double>(0, 0, 1.0));
+    for (int i = 1; i < n - 1; i++) {
+        Eigen::DenseIndex span = Spline2d::Span(params(i), degree, knots);
+        Spline2d::BasisVectorType basis = Spline2d::BasisFunctions(params(i), degree, knots);
+        for (int k = 0; k <= degree; k++)
+            entries.push_back(Eigen::Triplet<double>(i, span - degree + k, basis(k)));
+    }
+    entries.push_back(Eigen::Triplet<double>(n - 1, n - 1, 1.0));
+
+    Eigen::SparseMatrix<double> A(n, n);
+    A.setFromTriplets(entries.begin(), entries.end());
+
+    Eigen::SparseLU<Eigen::SparseMatrix<double> > solver;
+    solver.compute(A);
+    if (solver.info() != Eigen::Success)
+        return false;
+
+    Eigen::MatrixXd ctrls = solver.solve(pts);
+    if (solver.info() != Eigen::Success)
+        return false;
+
+    spline_ = Spline2d(knots, ctrls.transpose());
+    length_ = length;
+    buildArcTable(params, s, n);
+    return true;
+}
+
+void ReferenceSpline::buildArcTable(const Spline2d::KnotVectorType &params, const double *s, int n) {
+
+    const int subdivisions = kSubdivisions;
+    int entries = (n - 1) * subdivisions + 1;
+    table_u_.assign(entries, 1.0);
+    table_s_.assign(entries, s[n - 1]);
+    table_scale_.assign(entries - 1, 1.0);
+
+    // each waypoint span keeps the waypoint s at both ends and spreads its s over the arc length
+    double arc[subdivisions];
+    for (int i = 0; i < n - 1; i++) {
+        double du = (params(i + 1) - params(i)) / subdivisions;
+        double span = 0.0;
+        for (int m = 0; m < subdivisions; m++) {
+            table_u_[i * subdivisions + m] = params(i) + m * du;
+            arc[m] = integrate(params(i) + m * du, params(i) + (m + 1) * du);
+            span += arc[m];
+        }
+
+        double scale = span > 0 ? (s[i + 1] - s[i]) / span : 1.0;
+        double span_s = s[i];
+        for (int m = 0; m < subdivisions; m++) {
+            table_s_[i * subdivisions + m] = span_s;
+            table_scale_[i * subdivisions + m] = scale;
+            span_s += scale * arc[m];
+        }
+    }
+}
+
+double ReferenceSpline::speed(double u) const {
+    auto der = spline_.derivatives<1>(u);
+    return sqrt(der(0, 1) * der(0, 1) + der(1, 1) * der(1, 1));
+}
+
+double ReferenceSpline::integrate(double u0, double u1) const {
+
+    // arc length between u0 and u1, 3-point Gauss-Legendre like ArcLengthTable
+    const double node = sqrt(0.6);
+    double mid = 0.5 * (u0 + u1), half = 0.5 * (u1 - u0);
+    return half * (5.0 / 9.0 * speed(mid - half * node) + 8.0 / 9.0 * speed(mid) + 5.0 / 9.0 * speed(mid + half * node));
+}
+
+double ReferenceSpline::parameter(double s) const {
+
+    // linear guess inside the table interval around s, then one Newton step on its arc length
+    int k = int(upper_bound(table_s_.begin(), table_s_.end(), s) - table_s_.begin()) - 1;
+    k = max(0, min(k, int(table_s_.size()) - 2));
+    double u0 = table_u_[k], ds = table_s_[k + 1] - table_s_[k];
+    double u = ds > 0 ? u0 + (s - table_s_[k]) / ds * (table_u_[k + 1] - u0) : u0;
+    double v = speed(u);
+    if (v > 0)
+        u -= (table_s_[k] + table_scale_[k] * integrate(u0, u) - s) / (table_scale_[k] * v);
+    return min(max(u, 0.0), 1.0);
+}
+
+double ReferenceSpline::sAt(double u) const {
+
+    int k = int(upper_bound(table_u_.begin(), table_u_.end(), u) - table_u_.begin()) - 1;
+    k = max(0, min(k, int(table_u_.size()) - 2));
+    return table_s_[k] + table_scale_[k] * integrate(table_u_[k], u);
+}
+
+void ReferenceSpline::evaluate(double s, double &x, double &y, double &cos_h, double &sin_h) const {
+
+    // past both ends the line continues straight along the end tangent
+    double s_clamped = min(max(s, s0_), s0_ + length_);
+
+    auto der = spline_.derivatives<1>(parameter(s_clamped));
+    double dx = der(0, 1), dy = der(1, 1);
+    double norm = sqrt(dx * dx + dy * dy);
+
+    cos_h = dx / norm;
+    sin_h = dy / norm;
+    x = der(0, 0) + (s - s_clamped) * cos_h;
+    y = der(1, 0) + (s - s_clamped) * sin_h;
+}
+
+double ReferenceSpline::curvature(double s) const {
+
+    auto der = spline_.derivatives<2>(parameter(min(max(s, s0_), s0_ + length_)));
+    double dx = der(0, 1), dy = der(1, 1);
+    double ddx = der(0, 2), ddy = der(1, 2);
+
+    // invariant to the parameterization, so u can be used instead of arc length
+    return (dx * ddy - dy * ddx) / pow(dx * dx + dy * dy, 1.5);
+}
+
+void ReferenceSpline::getXY(double s, double d, double &x, double &y) const {
+
+    double cos_h, sin_h;
+    evaluate(s, x, y, cos_h, sin_h);
+
+    // d grows to the right of the direction of travel
+    x += d * sin_h;
+    y -= d * cos_h;
+}
+
+bool ReferenceSpline::getFrenet(double x, double y, double s_guess, double &s, double &d) const {
+
+    double u = parameter(min(max(s_guess, s0_), s0_ + length_));
+    bool converged = false;
+
+    // minimize the squared distance to the spline: g(u) = (P(u) - q) . P'(u) = 0
+    for (int iter = 0; iter < 8 && !converged; iter++) {
+        auto der = spline_.derivatives<2>(u);
+        double ex = der(0, 0) - x, ey = der(1, 0) - y;
+        double g = ex * der(0, 1) + ey * der(1, 1);
+        double dg = der(0, 1) * der(0, 1) + der(1, 1) * der(1, 1) + ex * der(0, 2) + ey * der(1, 2);
+        if (dg <= 0)
+            break;
+
+        double step = g / dg;
+        u = min(max(u - step, 0.0), 1.0);
+        converged = fabs(step) * length_ < 1e-6;
+    }
+
+    auto der = spline_.derivatives<1>(u);
+    double norm = sqrt(der(0, 1) * der(0, 1) + der(1, 1) * der(1, 1));
+    s = sAt(u);
+    d = ((x - der(0, 0)) * der(1, 1) - (y - der(1, 0)) * der(0, 1)) / norm;
+
+    return converged;
+}
@@ -0,0 +1,63 @@
+#ifndef REFERENCE_SPLINE_H
+#define REFERENCE_SPLINE_H
+
+#include <vector>
+#include <Eigen/Core>
+#include <unsupported/Eigen/Splines>
+
+// Smooth reference line through the waypoints.
+//
+// x(u) and y(u) form one cubic B-spline (Eigen Splines module) interpolating the waypoints,
+// with the waypoint u = (s - s0) / length taken from the waypoint s values. Positions, headings
+// and curvature come straight from the spline derivatives, so getXY() and getFrenet() are
+// continuous along the road instead of jumping at every waypoint.
+//
+// s is not u scaled: between two waypoints it is proportional to the arc length along the
+// spline, tabulated at kSubdivisions points per waypoint span, so a point moving at constant
+// ds/dt moves at constant speed along the line. At the waypoints s stays the waypoint s, the
+// s the simulator reports, so within a span it differs from the arc length by the ratio of the
+// waypoint spacing to the span's arc length, at most 0.6% on the Bosch map (2.6% for u linear in s).
+class ReferenceSpline {
+public:
+    static const int kSubdivisions = 16;
+
+    ReferenceSpline(): s0_(0.0), length_(0.0) {}
+
+    // Interpolate the waypoints, s has to be strictly increasing. Returns false if there are too few.
+    bool fit(const double *x, const double *y, const double *s, int n);
+
+    bool empty() const { return length_ <= 0; }
+    double startS() const { return s0_; }
+    double endS() const { return s0_ + length_; }
+
+    // Point on the reference line at s, its unit tangent (cos, sin of the heading) and curvature
+    void evaluate(double s, double &x, double &y, double &cos_h, double &sin_h) const;
+    double curvature(double s) const;
+
+    // Transform from Frenet s,d coordinates to Cartesian x,y
+    void getXY(double s, double d, double &x, double &y) const;
+
+    // Transform from Cartesian x,y coordinates to Frenet s,d coordinates with Newton steps on the
+    // projection onto the spline, starting at s_guess. Returns false if they did not converge.
+    bool getFrenet(double x, double y, double s_guess, double &s, double &d) const;
+
+    // Spline parameter u at s and s at u, within the ends of the spline
+    double parameter(double s) const;
+    double sAt(double u) const;
+
+private:
+    typedef Eigen::Spline<double, 2, 3> Spline2d;
+
+    void buildArcTable(const Spline2d::KnotVectorType &params, const double *s, int n);
+    double integrate(double u0, double u1) const;
+    double speed(double u) const;
+
+    Spline2d spline_;
+    double s0_, length_;
+
+    // table_s_[k] is s at the spline parameter table_u_[k], table_scale_[k] is ds per unit of arc
+    // length from there to the next entry
+    std::vector<double> table_u_, table_s_, table_scale_;
+};
+
+#endif /* REFERENCE_SPLINE_H */
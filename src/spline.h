@@ -29,6 +29,8 @@
 
 #include <cstdio>
 #include <cassert>
+#include <cmath>
+#include <array>
 #include <vector>
 #include <algorithm>
 
@@ -111,6 +113,62 @@ public:
     void set_points(const std::vector<double>& x,
                     const std::vector<double>& y, bool cubic_spline=true);
     double operator() (double x) const;
+    // out[i] = (*this)(xs[i]), eval_sorted() requires xs to be increasing
+    void eval(const double* xs, size_t n, double* out) const;
+    void eval_sorted(const double* xs, size_t n, double* out) const;
+    // first, second or third derivative at x, and the signed curvature
+    // f''/(1+f'^2)^(3/2) of the graph y=f(x)
+    double deriv(double x, int order) const;
+    double curvature(double x) const;
+};
+
+
+// spline interpolation through a fixed number of points N, same results as
+// spline but without heap allocations: the points and coefficients live in
+// std::arrays and the tridiagonal system is solved directly (Thomas algorithm)
+template<int N>
+class fixed_spline
+{
+public:
+    typedef spline::bd_type bd_type;
+
+private:
+    std::array<double, N> m_x,m_y;          // x,y coordinates of points
+    // interpolation parameters
+    // f(x) = a*(x-x_i)^3 + b*(x-x_i)^2 + c*(x-x_i) + y_i
+    std::array<double, N> m_a,m_b,m_c;      // spline coefficients
+    double  m_b0, m_c0;                     // for left extrapol
+    bd_type m_left, m_right;
+    double  m_left_value, m_right_value;
+    bool    m_force_linear_extrapolation;
+
+public:
+    // set default boundary condition to be zero curvature at both ends
+    fixed_spline(): m_left(spline::second_deriv), m_right(spline::second_deriv),
+        m_left_value(0.0), m_right_value(0.0),
+        m_force_linear_extrapolation(false)
+    {
+        static_assert(N>2, "fixed_spline needs at least 3 points");
+    }
+
+    // optional, but if called it has to come be before set_points()
+    void set_boundary(bd_type left, double left_value,
+                      bd_type right, double right_value,
+                      bool force_linear_extrapolation=false);
+    void set_points(const double* x, const double* y, bool cubic_spline=true);
+    void set_points(const std::array<double, N>& x,
+                    const std::array<double, N>& y, bool cubic_spline=true)
+    {
+        set_points(x.data(), y.data(), cubic_spline);
+    }
+    double operator() (double x) const;
+    // out[i] = (*this)(xs[i]), eval_sorted() requires xs to be increasing
+    void eval(const double* xs, size_t n, double* out) const;
+    void eval_sorted(const double* xs, size_t n, double* out) const;
+    // first, second or third derivative at x, and the signed curvature
+    // f''/(1+f'^2)^(3/2) of the graph y=f(x)
+    double deriv(double x, int order) const;
+    double curvature(double x) const;
 };
 
 
@@ -120,6 +178,110 @@ public:
 // ---------------------------------------------------------------------
 
 
+// batch evaluation shared by spline and fixed_spline
+// -------------------------------------------------
+
+// Evaluates the piecewise cubic with points x[0..n-1] and coefficients a,b,c
+// (b0,c0 left of x[0]) at xs[0..count-1]. Sorted samples are split into runs
+// on the same segment by advancing a cursor, each run is one Horner loop with
+// fixed coefficients. Other samples are binary searched in chunks, then all
+// samples of a chunk go through one Horner loop on gathered coefficients.
+// Either way the Horner loops are what the compiler vectorizes.
+inline double spline_deriv(const double* x, const double* a, const double* b,
+                           const double* c, int n, double b0, double c0,
+                           double xq, int order)
+{
+    assert(order>=1 && order<=3);
+    int idx=std::max( int(std::lower_bound(x,x+n,xq)-x)-1, 0);
+    double h=xq-x[idx];
+    double da=a[idx], db=b[idx], dc=c[idx];
+    if(xq<x[0]) {
+        // extrapolation to the left
+        da=0.0;
+        db=b0;
+        dc=c0;
+    }
+    switch(order) {
+    case 1:
+        return (3.0*da*h + 2.0*db)*h + dc;
+    case 2:
+        return 6.0*da*h + 2.0*db;
+    case 3:
+        return 6.0*da;
+    default:
+        return 0.0;
+    }
+}
+
+inline void spline_eval_run(double x0, double y0, double a, double b, double c,
+                            const double* xs, size_t count, double* out)
+{
+    for(size_t k=0; k<count; k++) {
+        double h=xs[k]-x0;
+        out[k]=((a*h + b)*h + c)*h + y0;
+    }
+}
+
+inline void spline_eval(const double* x, const double* y, const double* a,
+                        const double* b, const double* c, int n,
+                        double b0, double c0,
+                        const double* xs, size_t count, double* out,
+                        bool sorted)
+{
+    if(sorted) {
+        // extrapolation to the left
+        size_t start=0;
+        while(start<count && xs[start]<x[0]) start++;
+        spline_eval_run(x[0], y[0], 0.0, b0, c0, xs, start, out);
+
+        // closest point x[idx] < xs[k], extrapolation to the right with a[n-1]=0
+        int idx=0;
+        while(start<count) {
+            while(idx+1<n && x[idx+1]<xs[start]) idx++;
+            size_t end=start+1;
+            if(idx+1<n) {
+                while(end<count && xs[end]<=x[idx+1]) end++;
+            } else {
+                end=count;
+            }
+            spline_eval_run(x[idx], y[idx], a[idx], b[idx], c[idx],
+                            xs+start, end-start, out+start);
+            start=end;
+        }
+        return;
+    }
+
+    const size_t chunk=64;
+    double px[chunk], py[chunk], pa[chunk], pb[chunk], pc[chunk];
+    for(size_t start=0; start<count; start+=chunk) {
+        size_t m=std::min(chunk, count-start);
+        const double* xq=xs+start;
+        for(size_t k=0; k<m; k++) {
+            // closest point x[idx] < xq[k], idx=0 even if xq[k]<x[0]
+            int idx=std::max( int(std::lower_bound(x,x+n,xq[k])-x)-1, 0);
+            px[k]=x[idx];
+            py[k]=y[idx];
+            if(xq[k]<x[0]) {
+                // extrapolation to the left
+                pa[k]=0.0;
+                pb[k]=b0;
+                pc[k]=c0;
+            } else {
+                // interpolation, or extrapolation to the right with a[n-1]=0
+                pa[k]=a[idx];
+                pb[k]=b[idx];
+                pc[k]=c[idx];
+            }
+        }
+        double* o=out+start;
+        for(size_t k=0; k<m; k++) {
+            double h=xq[k]-px[k];
+            o[k]=((pa[k]*h + pb[k])*h + pc[k])*h + py[k];
+        }
+    }
+}
+
+
 // band_matrix implementation
 // -------------------------
 
@@ -395,6 +557,185 @@ double spline::operator() (double x) const
     return interpol;
 }
 
+void spline::eval(const double* xs, size_t n, double* out) const
+{
+    spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                m_x.size(), m_b0, m_c0, xs, n, out, false);
+}
+
+void spline::eval_sorted(const double* xs, size_t n, double* out) const
+{
+    spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                m_x.size(), m_b0, m_c0, xs, n, out, true);
+}
+
+double spline::deriv(double x, int order) const
+{
+    return spline_deriv(m_x.data(), m_a.data(), m_b.data(), m_c.data(),
+                        m_x.size(), m_b0, m_c0, x, order);
+}
+
+double spline::curvature(double x) const
+{
+    double d1=deriv(x, 1);
+    return deriv(x, 2)/std::pow(1.0+d1*d1, 1.5);
+}
+
+
+
+// fixed_spline implementation
+// ---------------------------
+
+template<int N>
+void fixed_spline<N>::set_boundary(bd_type left, double left_value,
+                                   bd_type right, double right_value,
+                                   bool force_linear_extrapolation)
+{
+    m_left=left;
+    m_right=right;
+    m_left_value=left_value;
+    m_right_value=right_value;
+    m_force_linear_extrapolation=force_linear_extrapolation;
+}
+
+template<int N>
+void fixed_spline<N>::set_points(const double* x, const double* y,
+                                 bool cubic_spline)
+{
+    const int n=N;
+    std::copy(x, x+n, m_x.begin());
+    std::copy(y, y+n, m_y.begin());
+    for(int i=0; i<n-1; i++) {
+        assert(m_x[i]<m_x[i+1]);
+    }
+
+    if(cubic_spline==true) { // cubic spline interpolation
+        // same equation system for the parameters b[] as spline::set_points(),
+        // stored as its three diagonals
+        std::array<double, N> lower, diag, upper, rhs;
+        for(int i=1; i<n-1; i++) {
+            lower[i]=1.0/3.0*(x[i]-x[i-1]);
+            diag[i]=2.0/3.0*(x[i+1]-x[i-1]);
+            upper[i]=1.0/3.0*(x[i+1]-x[i]);
+            rhs[i]=(y[i+1]-y[i])/(x[i+1]-x[i]) - (y[i]-y[i-1])/(x[i]-x[i-1]);
+        }
+        // boundary conditions
+        if(m_left == spline::second_deriv) {
+            diag[0]=2.0;
+            upper[0]=0.0;
+            rhs[0]=m_left_value;
+        } else if(m_left == spline::first_deriv) {
+            diag[0]=2.0*(x[1]-x[0]);
+            upper[0]=1.0*(x[1]-x[0]);
+            rhs[0]=3.0*((y[1]-y[0])/(x[1]-x[0])-m_left_value);
+        } else {
+            assert(false);
+        }
+        if(m_right == spline::second_deriv) {
+            diag[n-1]=2.0;
+            lower[n-1]=0.0;
+            rhs[n-1]=m_right_value;
+        } else if(m_right == spline::first_deriv) {
+            diag[n-1]=2.0*(x[n-1]-x[n-2]);
+            lower[n-1]=1.0*(x[n-1]-x[n-2]);
+            rhs[n-1]=3.0*(m_right_value-(y[n-1]-y[n-2])/(x[n-1]-x[n-2]));
+        } else {
+            assert(false);
+        }
+
+        // forward elimination, upper[] and rhs[] are overwritten
+        upper[0]/=diag[0];
+        rhs[0]/=diag[0];
+        for(int i=1; i<n; i++) {
+            double m=diag[i]-lower[i]*upper[i-1];
+            assert(m!=0.0);
+            upper[i]/=m;
+            rhs[i]=(rhs[i]-lower[i]*rhs[i-1])/m;
+        }
+        // back substitution
+        m_b[n-1]=rhs[n-1];
+        for(int i=n-2; i>=0; i--) {
+            m_b[i]=rhs[i]-upper[i]*m_b[i+1];
+        }
+
+        // calculate parameters a[] and c[] based on b[]
+        for(int i=0; i<n-1; i++) {
+            m_a[i]=1.0/3.0*(m_b[i+1]-m_b[i])/(x[i+1]-x[i]);
+            m_c[i]=(y[i+1]-y[i])/(x[i+1]-x[i])
+                   - 1.0/3.0*(2.0*m_b[i]+m_b[i+1])*(x[i+1]-x[i]);
+        }
+    } else { // linear interpolation
+        for(int i=0; i<n-1; i++) {
+            m_a[i]=0.0;
+            m_b[i]=0.0;
+            m_c[i]=(m_y[i+1]-m_y[i])/(m_x[i+1]-m_x[i]);
+        }
+        m_b[n-1]=0.0;
+    }
+
+    // for left extrapolation coefficients
+    m_b0 = (m_force_linear_extrapolation==false) ? m_b[0] : 0.0;
+    m_c0 = m_c[0];
+
+    // for the right extrapolation coefficients
+    // f_{n-1}(x) = b*(x-x_{n-1})^2 + c*(x-x_{n-1}) + y_{n-1}
+    double h=x[n-1]-x[n-2];
+    // m_b[n-1] is determined by the boundary condition
+    m_a[n-1]=0.0;
+    m_c[n-1]=3.0*m_a[n-2]*h*h+2.0*m_b[n-2]*h+m_c[n-2];   // = f'_{n-2}(x_{n-1})
+    if(m_force_linear_extrapolation==true)
+        m_b[n-1]=0.0;
+}
+
+template<int N>
+double fixed_spline<N>::operator() (double x) const
+{
+    // find the closest point m_x[idx] < x, idx=0 even if x<m_x[0]
+    int idx=std::max( int(std::lower_bound(m_x.begin(),m_x.end(),x)-m_x.begin())-1, 0);
+
+    double h=x-m_x[idx];
+    double interpol;
+    if(x<m_x[0]) {
+        // extrapolation to the left
+        interpol=(m_b0*h + m_c0)*h + m_y[0];
+    } else if(x>m_x[N-1]) {
+        // extrapolation to the right
+        interpol=(m_b[N-1]*h + m_c[N-1])*h + m_y[N-1];
+    } else {
+        // interpolation
+        interpol=((m_a[idx]*h + m_b[idx])*h + m_c[idx])*h + m_y[idx];
+    }
+    return interpol;
+}
+
+template<int N>
+void fixed_spline<N>::eval(const double* xs, size_t n, double* out) const
+{
+    spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                N, m_b0, m_c0, xs, n, out, false);
+}
+
+template<int N>
+void fixed_spline<N>::eval_sorted(const double* xs, size_t n, double* out) const
+{
+    spline_eval(m_x.data(), m_y.data(), m_a.data(), m_b.data(), m_c.data(),
+                N, m_b0, m_c0, xs, n, out, true);
+}
+
+template<int N>
+double fixed_spline<N>::deriv(double x, int order) const
+{
+    return spline_deriv(m_x.data(), m_a.data(), m_b.data(), m_c.data(),
+                        N, m_b0, m_c0, x, order);
+}
+
+template<int N>
+double fixed_spline<N>::curvature(double x) const
+{
+    double d1=deriv(x, 1);
+    return deriv(x, 2)/std::pow(1.0+d1*d1, 1.5);
+}
+
 
 } // namespace tk
 
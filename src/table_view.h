@@ -0,0 +1,31 @@
+#ifndef TABLE_VIEW_H
+#define TABLE_VIEW_H
+
+#include <cstddef>
+
+// Read-only view of a contiguous table of n values.
+//
+// The map tables are either built in memory or live inside a memory-mapped map file,
+// the code reading them does not need to know which.
+template <typename T>
+class TableView {
+public:
+    TableView(): data_(nullptr), size_(0) {}
+    TableView(const T *data, size_t size): data_(data), size_(size) {}
+
+    const T &operator[](size_t i) const { return data_[i]; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const T *data() const { return data_; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+    const T &front() const { return data_[0]; }
+    const T &back() const { return data_[size_ - 1]; }
+
+private:
+    const T *data_;
+    size_t size_;
+};
+
+#endif /* TABLE_VIEW_H */
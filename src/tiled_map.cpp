@@ -0,0 +1,242 @@
+#include "tiled_map.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// waypoints shared with each neighbouring tile
+const int kTileOverlap = 2;
+
+}
+
+TiledMap::TiledMap(int tile_waypoints, int tiles_ahead, int tiles_behind)
+    : tile_waypoints_(max(tile_waypoints, 2 * kTileOverlap)), tiles_ahead_(max(tiles_ahead, 0)),
+      tiles_behind_(max(tiles_behind, 0)), waypoints_(0), end_s_(0.0), current_(-1), last_s_(0.0), direction_(1) {}
+
+bool TiledMap::open(const string &map_file) {
+
+    // finish the loads of a previous route before the index changes under them
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (auto &load: pending_)
+            load.second.wait();
+        pending_.clear();
+        resident_.clear();
+    }
+    tile_s_.clear();
+    tile_offset_.clear();
+    tile_count_.clear();
+    waypoints_ = 0;
+    current_ = -1;
+
+    ifstream in_map_(map_file.c_str(), ifstream::in);
+
+    // offsets of the last kTileOverlap lines, the tile with the next waypoint starts that far back
+    vector<streamoff> recent(kTileOverlap + 1, 0);
+    double prev_s = 0.0;
+    string line;
+    streamoff offset = in_map_.tellg();
+    while (getline(in_map_, line)) {
+        istringstream iss(line);
+        double x, y, s;
+        if (!(iss >> x >> y >> s)) {
+            offset = in_map_.tellg();
+            continue;
+        }
+        // like HighwayMap::build(), only the leading run with increasing s
+        if (waypoints_ > 0 && s <= prev_s)
+            break;
+
+        recent.erase(recent.begin());
+        recent.push_back(offset);
+        if (waypoints_ % tile_waypoints_ == 0) {
+            tile_s_.push_back(s);
+            tile_offset_.push_back(recent[max(0, kTileOverlap - waypoints_)]);
+        }
+        prev_s = s;
+        waypoints_++;
+        offset = in_map_.tellg();
+    }
+    if (waypoints_ == 0)
+        return false;
+
+    end_s_ = prev_s;
+    for (int t = 0; t < tiles(); t++) {
+        int first = max(t * tile_waypoints_ - kTileOverlap, 0);
+        int last = min((t + 1) * tile_waypoints_ + kTileOverlap, waypoints_);
+        tile_count_.push_back(last - first);
+    }
+    map_file_ = map_file;
+    return true;
+}
+
+TiledMap::Tile TiledMap::loadTile(string map_file, streamoff offset, int count) {
+
+    vector<double> x, y, s, dx, dy;
+    ifstream in_map_(map_file.c_str(), ifstream::in);
+    in_map_.seekg(offset);
+
+    string line;
+    while (int(x.size()) < count && getline(in_map_, line)) {
+        istringstream iss(line);
+        double wx, wy, ws, wdx, wdy;
+        if (!(iss >> wx >> wy >> ws >> wdx >> wdy))
+            continue;
+        x.push_back(wx);
+        y.push_back(wy);
+        s.push_back(ws);
+        dx.push_back(wdx);
+        dy.push_back(wdy);
+    }
+
+    shared_ptr<HighwayMap> tile(new HighwayMap);
+    tile->build(x, y, s, dx, dy, false);
+    return tile;
+}
+
+int TiledMap::residentTiles() const {
+    lock_guard<mutex> lock(mutex_);
+    return int(resident_.size());
+}
+
+int TiledMap::tileAt(double s) const {
+    int t = int(upper_bound(tile_s_.begin(), tile_s_.end(), s) - tile_s_.begin()) - 1;
+    return min(max(t, 0), tiles() - 1);
+}
+
+void TiledMap::prefetch(int t) {
+    if (t < 0 || t >= tiles() || resident_.count(t) || pending_.count(t))
+        return;
+    pending_[t] = async(launch::async, &TiledMap::loadTile, map_file_, tile_offset_[t], tile_count_[t]);
+}
+
+void TiledMap::collect() {
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        if (it->second.wait_for(chrono::seconds(0)) == future_status::ready) {
+            resident_[it->first] = it->second.get();
+            it = pending_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+TiledMap::Tile TiledMap::tile(int t) const {
+
+    unique_lock<mutex> lock(mutex_);
+    auto it = resident_.find(t);
+    if (it != resident_.end())
+        return it->second;
+
+    // wait for the load or read the tile without the lock, queries on the resident tiles go on meanwhile
+    future<Tile> load;
+    auto pending = pending_.find(t);
+    if (pending != pending_.end()) {
+        load = move(pending->second);
+        pending_.erase(pending);
+    }
+    lock.unlock();
+    Tile loaded = load.valid() ? load.get() : loadTile(map_file_, tile_offset_[t], tile_count_[t]);
+
+    // another query may have read it at the same time, keep the first one
+    lock.lock();
+    return resident_.insert(make_pair(t, loaded)).first->second;
+}
+
+void TiledMap::update(double ego_s) {
+
+    if (tiles() == 0)
+        return;
+
+    if (current_ >= 0 && ego_s != last_s_)
+        direction_ = ego_s > last_s_ ? 1 : -1;
+    last_s_ = ego_s;
+    current_ = tileAt(ego_s);
+
+    tile(current_);
+
+    lock_guard<mutex> lock(mutex_);
+    collect();
+
+    // window of tiles to keep, ahead and behind in the direction of travel
+    int lo = current_ - (direction_ > 0 ? tiles_behind_ : tiles_ahead_);
+    int hi = current_ + (direction_ > 0 ? tiles_ahead_ : tiles_behind_);
+    for (int k = 1; k <= tiles_ahead_; k++)
+        prefetch(current_ + direction_ * k);
+
+    for (auto it = resident_.begin(); it != resident_.end();) {
+        if (it->first < lo || it->first > hi)
+            it = resident_.erase(it);
+        else
+            ++it;
+    }
+}
+
+vector<double> TiledMap::getFrenet(double x, double y, double theta) const {
+
+    if (tiles() == 0)
+        return {0.0, 0.0};
+
+    // tiles are open maps, their s is the route's s from the map file
+    int t = current_ >= 0 ? current_ : 0;
+    vector<double> sd = tile(t)->getFrenet(x, y, theta);
+
+    // outside the waypoints the tile owns, the neighbouring tile has the segments around the point
+    int owner = tileAt(sd[0]);
+    if (owner != t)
+        sd = tile(owner)->getFrenet(x, y, theta);
+    return sd;
+}
+
+vector<double> TiledMap::getXY(double s, double d) const {
+
+    if (tiles() == 0)
+        return {0.0, 0.0};
+
+    return tile(tileAt(s))->getXY(s, d);
+}
+
+void TiledMap::getFrenetBatch(const double *x, const double *y, const double *theta, int n, double *s,
+                              double *d) const {
+
+    if (tiles() == 0) {
+        fill(s, s + n, 0.0);
+        fill(d, d + n, 0.0);
+        return;
+    }
+
+    int t = current_ >= 0 ? current_ : 0;
+    tile(t)->getFrenetBatch(x, y, theta, n, s, d);
+
+    // like getFrenet(), the points outside the waypoints the tile owns go to their own tile
+    for (int i = 0; i < n; i++) {
+        int owner = tileAt(s[i]);
+        if (owner != t) {
+            vector<double> sd = tile(owner)->getFrenet(x[i], y[i], theta[i]);
+            s[i] = sd[0];
+            d[i] = sd[1];
+        }
+    }
+}
+
+void TiledMap::getXYBatch(const double *s, const double *d, int n, double *x, double *y) const {
+
+    if (tiles() == 0) {
+        fill(x, x + n, 0.0);
+        fill(y, y + n, 0.0);
+        return;
+    }
+
+    for (int start = 0; start < n;) {
+        int t = tileAt(s[start]);
+        int end = start + 1;
+        while (end < n && tileAt(s[end]) == t)
+            end++;
+        tile(t)->getXYBatch(s + start, d + start, end - start, x + start, y + start);
+        start = end;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef TILED_MAP_H
+#define TILED_MAP_H
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "highway_map.h"
+
+// Waypoint map streamed from a CSV map file in tiles along s, for routes too long to keep in memory.
+//
+// open() makes one pass over the file and keeps only the s value and file offset of every tile.
+// Each tile is an open HighwayMap over tile_waypoints waypoints plus a few overlapping ones on both
+// sides, so queries near a tile border still see the neighbouring segments, and past its ends it
+// continues straight instead of closing back to its first waypoint. update() keeps the
+// tile around the ego resident, loads the next tiles in the direction of travel on background
+// threads and drops the tiles behind, so memory and query cost do not grow with the route.
+// Tiles follow the waypoint segments, they are not fitted with a spline or resampled. The planner
+// does not use tiles yet, the Bosch track is one short loop that HighwayMap keeps whole.
+//
+// Queries are const and may run on several threads at once, e.g. on the candidate pool. The tiles
+// they load and the pending loads are guarded by mutex_, update() and open() run on one thread.
+class TiledMap {
+public:
+    explicit TiledMap(int tile_waypoints = 256, int tiles_ahead = 2, int tiles_behind = 1);
+
+    // Index the waypoints of a CSV map file, returns false if no waypoint could be read
+    bool open(const std::string &map_file);
+
+    int tiles() const { return int(tile_s_.size()); }
+    int waypoints() const { return waypoints_; }
+    int residentTiles() const;
+    double startS() const { return tile_s_.empty() ? 0.0 : tile_s_.front(); }
+    double endS() const { return end_s_; }
+
+    // Tile around ego_s, keep it resident and prefetch/evict the others. Waits for the tile itself
+    // if it is not loaded yet.
+    void update(double ego_s);
+
+    // Same as HighwayMap::getFrenet() and getXY() on the whole route. Tiles outside the window of
+    // the last update() are loaded on the spot and dropped by the next update().
+    std::vector<double> getFrenet(double x, double y, double theta) const;
+    std::vector<double> getXY(double s, double d) const;
+
+    // Same as getFrenet() and getXY() for n points, such as the points of a trajectory. Runs of points in one
+    // tile go through the tile's batch functions.
+    void getFrenetBatch(const double *x, const double *y, const double *theta, int n, double *s, double *d) const;
+    void getXYBatch(const double *s, const double *d, int n, double *x, double *y) const;
+
+private:
+    typedef std::shared_ptr<const HighwayMap> Tile;
+
+    TiledMap(const TiledMap &);
+    TiledMap &operator=(const TiledMap &);
+
+    int tileAt(double s) const;
+    Tile tile(int t) const;
+    void prefetch(int t);
+    void collect();
+
+    static Tile loadTile(std::string map_file, std::streamoff offset, int count);
+
+    int tile_waypoints_, tiles_ahead_, tiles_behind_;
+
+    std::string map_file_;
+    int waypoints_;
+    double end_s_;
+
+    // per tile: s of its first own waypoint, file offset and number of waypoints including the overlap
+    std::vector<double> tile_s_;
+    std::vector<std::streamoff> tile_offset_;
+    std::vector<int> tile_count_;
+
+    int current_;
+    double last_s_;
+    int direction_;
+    mutable std::mutex mutex_;
+    mutable std::map<int, Tile> resident_;
+    mutable std::map<int, std::future<Tile> > pending_;
+};
+
+#endif /* TILED_MAP_H */
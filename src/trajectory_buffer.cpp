@@ -0,0 +1,58 @@
+#include "trajectory_buffer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+TickArena::TickArena(size_t bytes): offset_(0), used_(0), high_water_(0) {
+    Chunk chunk;
+    chunk.data.reset(new char[bytes]);
+    chunk.size = bytes;
+    chunks_.push_back(std::move(chunk));
+}
+
+size_t TickArena::capacity() const {
+    size_t bytes = 0;
+    for (const Chunk &chunk: chunks_)
+        bytes += chunk.size;
+    return bytes;
+}
+
+void *TickArena::allocateBytes(size_t bytes, size_t align) {
+
+    Chunk *chunk = &chunks_.back();
+    uintptr_t base = reinterpret_cast<uintptr_t>(chunk->data.get());
+    size_t offset = (base + offset_ + align - 1) / align * align - base;
+
+    if (offset + bytes > chunk->size) {
+        // out of room, the next reset() merges the chunks into one that is large enough
+        used_ += offset_;
+        Chunk next;
+        next.size = max(2 * chunk->size, bytes + align);
+        next.data.reset(new char[next.size]);
+        chunks_.push_back(std::move(next));
+
+        chunk = &chunks_.back();
+        base = reinterpret_cast<uintptr_t>(chunk->data.get());
+        offset = (base + align - 1) / align * align - base;
+    }
+
+    offset_ = offset + bytes;
+    return chunk->data.get() + offset;
+}
+
+void TickArena::reset() {
+
+    high_water_ = max(high_water_, used());
+    if (chunks_.size() > 1) {
+        Chunk chunk;
+        chunk.size = max(capacity(), high_water_ * 2);
+        chunk.data.reset(new char[chunk.size]);
+        chunks_.clear();
+        chunks_.push_back(std::move(chunk));
+    }
+
+    offset_ = 0;
+    used_ = 0;
+}
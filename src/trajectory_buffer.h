@@ -0,0 +1,108 @@
+#ifndef TRAJECTORY_BUFFER_H
+#define TRAJECTORY_BUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for the data of one telemetry frame.
+//
+// Everything a frame plans with is carved from the arena and released at once by reset() after
+// the frame is answered. The arena keeps its memory, after a few frames it has grown to the
+// size a frame needs and allocate() no longer calls malloc.
+class TickArena {
+public:
+    explicit TickArena(size_t bytes = 256 * 1024);
+
+    // n default-initialized objects, so numbers are left uninitialized. The arena never runs
+    // destructors, T must not need one.
+    template<class T>
+    T *allocate(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        T *objects = static_cast<T *>(allocateBytes(n * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < n; i++)
+            new (objects + i) T;
+        return objects;
+    }
+
+    // Release everything allocated since the last reset
+    void reset();
+
+    size_t used() const { return used_ + offset_; }
+    size_t capacity() const;
+
+private:
+    TickArena(const TickArena &);
+    TickArena &operator=(const TickArena &);
+
+    void *allocateBytes(size_t bytes, size_t align);
+
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    // chunk being filled is the last one, used_ counts the bytes in the chunks before it
+    std::vector<Chunk> chunks_;
+    size_t offset_;
+    size_t used_;
+    size_t high_water_;
+};
+
+// Points of a trajectory in one array per coordinate, x/y and optionally Frenet s/d.
+// The arrays come from a TickArena and are only valid until it is reset.
+struct TrajectoryBuffer {
+    double *x = nullptr, *y = nullptr;
+    double *s = nullptr, *d = nullptr;
+    int size = 0, capacity = 0;
+
+    void allocate(TickArena &arena, int n, bool frenet = false) {
+        x = arena.allocate<double>(n);
+        y = arena.allocate<double>(n);
+        s = frenet ? arena.allocate<double>(n) : nullptr;
+        d = frenet ? arena.allocate<double>(n) : nullptr;
+        size = 0;
+        capacity = n;
+    }
+
+    void push_back(double px, double py) {
+        x[size] = px;
+        y[size] = py;
+        size++;
+    }
+
+    // s/d only, e.g. the anchors of the lane change candidates
+    void push_back_frenet(double ps, double pd) {
+        s[size] = ps;
+        d[size] = pd;
+        size++;
+    }
+
+    bool empty() const { return size == 0; }
+};
+
+// What calculateCost() reads of a trajectory: s, d of its points, the largest speed, acceleration
+// and jerk magnitudes between them and the mean speed
+struct TrajectoryReadings {
+    double *s = nullptr, *d = nullptr;
+    int size = 0;
+    double v_max = 0.0, v_mean = 0.0, a_max = 0.0, j_max = 0.0;
+
+    void allocate(TickArena &arena, int n) {
+        s = arena.allocate<double>(n);
+        d = arena.allocate<double>(n);
+        size = 0;
+        v_max = v_mean = a_max = j_max = 0.0;
+    }
+};
+
+// Speed (m/s), acceleration (m/s^2) and jerk (m/s^3) limits of the simulator. The lattice planner charges a
+// trajectory over any of them and the primitive library is validated against them, calculateCost() charges
+// the speed and acceleration limits but keeps its own jerk threshold
+const double kSpeedLimit = 49.5 / 2.24;
+const double kAccelLimit = 10.0;
+const double kJerkLimit = 10.0;
+
+#endif /* TRAJECTORY_BUFFER_H */
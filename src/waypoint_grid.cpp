@@ -0,0 +1,134 @@
+#include "waypoint_grid.h"
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+void WaypointGrid::build(const double *x, const double *y, int n, double cell_size) {
+
+    storage_.clear();
+    start_ = TableView<int>();
+    items_ = TableView<int>();
+    cols_ = rows_ = 0;
+    if (n == 0)
+        return;
+
+    double max_x, max_y;
+    min_x_ = max_x = x[0];
+    min_y_ = max_y = y[0];
+    double spacing = 0.0;
+    for (int i = 1; i < n; i++) {
+        min_x_ = min(min_x_, x[i]);
+        max_x = max(max_x, x[i]);
+        min_y_ = min(min_y_, y[i]);
+        max_y = max(max_y, y[i]);
+        spacing += sqrt((x[i] - x[i - 1]) * (x[i] - x[i - 1]) + (y[i] - y[i - 1]) * (y[i] - y[i - 1]));
+    }
+    if (n > 1)
+        spacing /= (n - 1);
+
+    // about one waypoint per cell along the road, but never more than ~4 cells per waypoint
+    cell_ = cell_size > 0 ? cell_size : max(spacing, 1.0);
+    double width = max_x - min_x_;
+    double height = max_y - min_y_;
+    while ((width / cell_ + 1) * (height / cell_ + 1) > 4.0 * n + 16)
+        cell_ *= 2;
+
+    cols_ = int(width / cell_) + 1;
+    rows_ = int(height / cell_) + 1;
+
+    // counting sort of the waypoints by cell, cell starts and items share one block
+    int cells = cols_ * rows_;
+    storage_.assign(cells + 1 + n, 0);
+    int *start = &storage_[0];
+    int *items = &storage_[cells + 1];
+
+    vector<int> cell_of(n);
+    for (int i = 0; i < n; i++) {
+        cell_of[i] = cellRow(y[i]) * cols_ + cellCol(x[i]);
+        start[cell_of[i] + 1]++;
+    }
+    for (int c = 0; c < cells; c++)
+        start[c + 1] += start[c];
+
+    vector<int> fill(start, start + cells);
+    for (int i = 0; i < n; i++)
+        items[fill[cell_of[i]]++] = i;
+
+    start_ = TableView<int>(start, cells + 1);
+    items_ = TableView<int>(items, n);
+}
+
+void WaypointGrid::attach(int cols, int rows, double cell, double min_x, double min_y, const int *start,
+                          const int *items, int n) {
+    storage_.clear();
+    cols_ = cols;
+    rows_ = rows;
+    cell_ = cell;
+    min_x_ = min_x;
+    min_y_ = min_y;
+    start_ = TableView<int>(start, cols * rows + 1);
+    items_ = TableView<int>(items, n);
+}
+
+int WaypointGrid::cellCol(double x) const {
+    return max(0, min(cols_ - 1, int(floor((x - min_x_) / cell_))));
+}
+
+int WaypointGrid::cellRow(double y) const {
+    return max(0, min(rows_ - 1, int(floor((y - min_y_) / cell_))));
+}
+
+int WaypointGrid::nearest(double x, double y, const double *maps_x, const double *maps_y) const {
+
+    if (items_.empty())
+        return -1;
+
+    int cx = cellCol(x);
+    int cy = cellRow(y);
+
+    // distance from the query point to the border of its (clamped) cell, everything in ring r
+    // is at least this plus (r-1) cells away
+    double x0 = min_x_ + cx * cell_, y0 = min_y_ + cy * cell_;
+    double inner = min(min(x - x0, x0 + cell_ - x), min(y - y0, y0 + cell_ - y));
+    inner = max(inner, 0.0);
+
+    int best = -1;
+    double best_d2 = numeric_limits<double>::max();
+    int max_ring = max(cols_, rows_);
+
+    for (int r = 0; r <= max_ring; r++) {
+
+        if (best >= 0 && r > 0) {
+            double bound = inner + (r - 1) * cell_;
+            if (best_d2 < bound * bound)
+                break;
+        }
+
+        for (int j = cy - r; j <= cy + r; j++) {
+            if (j < 0 || j >= rows_)
+                continue;
+
+            // full row on the top and bottom of the ring, only both ends in between
+            int step = (j == cy - r || j == cy + r) ? 1 : max(2 * r, 1);
+            for (int i = cx - r; i <= cx + r; i += step) {
+                if (i < 0 || i >= cols_)
+                    continue;
+
+                int c = j * cols_ + i;
+                for (int k = start_[c]; k < start_[c + 1]; k++) {
+                    int wp = items_[k];
+                    double d2 = (maps_x[wp] - x) * (maps_x[wp] - x) + (maps_y[wp] - y) * (maps_y[wp] - y);
+                    if (d2 < best_d2 || (d2 == best_d2 && wp < best)) {
+                        best_d2 = d2;
+                        best = wp;
+                    }
+                }
+            }
+        }
+    }
+
+    return best;
+}
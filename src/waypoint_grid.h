@@ -0,0 +1,51 @@
+#ifndef WAYPOINT_GRID_H
+#define WAYPOINT_GRID_H
+
+#include <vector>
+
+#include "table_view.h"
+
+// Uniform grid over the waypoints for nearest-waypoint queries.
+//
+// Waypoints are bucketed by cell in compressed form: the indices of the waypoints in
+// cell c are items_[start_[c]] .. items_[start_[c+1]-1]. A query visits rings of cells
+// around the query point and stops as soon as no unvisited cell can hold a closer
+// waypoint, so the cost depends on the local waypoint density and not on the map size.
+class WaypointGrid {
+public:
+    WaypointGrid(): cols_(0), rows_(0), cell_(1.0), min_x_(0.0), min_y_(0.0) {}
+
+    // Bucket the waypoints, cell_size <= 0 picks one from the mean waypoint spacing
+    void build(const double *x, const double *y, int n, double cell_size = 0.0);
+
+    // Use cell tables stored elsewhere, e.g. in a mapped map file
+    void attach(int cols, int rows, double cell, double min_x, double min_y, const int *start, const int *items, int n);
+
+    // Index of the waypoint closest to (x, y), the lowest index on ties. -1 if the grid is empty.
+    int nearest(double x, double y, const double *maps_x, const double *maps_y) const;
+
+    double cellSize() const { return cell_; }
+    int cells() const { return cols_ * rows_; }
+    int cols() const { return cols_; }
+    int rows() const { return rows_; }
+    double minX() const { return min_x_; }
+    double minY() const { return min_y_; }
+    const TableView<int> &start() const { return start_; }
+    const TableView<int> &items() const { return items_; }
+
+private:
+    WaypointGrid(const WaypointGrid &);
+    WaypointGrid &operator=(const WaypointGrid &);
+
+    int cellCol(double x) const;
+    int cellRow(double y) const;
+
+    int cols_, rows_;
+    double cell_;
+    double min_x_, min_y_;
+    std::vector<int> storage_;
+    TableView<int> start_;
+    TableView<int> items_;
+};
+
+#endif /* WAYPOINT_GRID_H */
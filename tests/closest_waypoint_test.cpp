@@ -0,0 +1,142 @@
+// HighwayMap::ClosestWaypoint() through the grid index against a linear scan over the waypoints.
+//
+// Checks random points around the Bosch map and a long synthetic route, and points exactly halfway
+// between waypoints, where both have to return the lower index. Prints every mismatch and fails if
+// there is any.
+//
+// usage: closest_waypoint_test [map file]
+
+#include <math.h>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/highway_map.h"
+
+using namespace std;
+
+namespace {
+
+int failures = 0;
+
+// the planner's original ClosestWaypoint(), the first waypoint wins on ties
+int linearClosest(double x, double y, const HighwayMap &map) {
+    double closestLen = 1e300;
+    int closestWaypoint = 0;
+    for (int i = 0; i < map.size(); i++) {
+        double dist = (x - map.x()[i]) * (x - map.x()[i]) + (y - map.y()[i]) * (y - map.y()[i]);
+        if (dist < closestLen) {
+            closestLen = dist;
+            closestWaypoint = i;
+        }
+    }
+    return closestWaypoint;
+}
+
+void check(const char *name, const HighwayMap &map, double x, double y) {
+    int linear = linearClosest(x, y, map);
+    int grid = map.ClosestWaypoint(x, y);
+    if (linear != grid) {
+        printf("%s: (%.17g, %.17g) closest %d, grid %d\n", name, x, y, linear, grid);
+        failures++;
+    }
+}
+
+void checkRandom(const char *name, const HighwayMap &map, int queries) {
+
+    double min_x = map.x()[0], max_x = min_x, min_y = map.y()[0], max_y = min_y;
+    for (int i = 0; i < map.size(); i++) {
+        min_x = min(min_x, map.x()[i]);
+        max_x = max(max_x, map.x()[i]);
+        min_y = min(min_y, map.y()[i]);
+        max_y = max(max_y, map.y()[i]);
+    }
+
+    // on the lanes, and anywhere in and around the bounding box of the map
+    mt19937 gen(3);
+    uniform_real_distribution<double> s_dist(0.0, map.s().back());
+    uniform_real_distribution<double> d_dist(-2.0, 14.0);
+    uniform_real_distribution<double> x_dist(min_x - 500.0, max_x + 500.0);
+    uniform_real_distribution<double> y_dist(min_y - 500.0, max_y + 500.0);
+    for (int i = 0; i < queries; i++) {
+        vector<double> xy = map.getXY(s_dist(gen), d_dist(gen));
+        check(name, map, xy[0], xy[1]);
+        check(name, map, x_dist(gen), y_dist(gen));
+    }
+}
+
+// waypoints on integer coordinates, so the points between them are at exactly the same distance from both
+void checkTies() {
+
+    // a straight road every 10m, the midpoints are on cell borders of the default grid
+    vector<double> x, y, s, dx, dy;
+    for (int i = 0; i < 50; i++) {
+        x.push_back(10.0 * i);
+        y.push_back(0.0);
+        s.push_back(10.0 * i);
+        dx.push_back(0.0);
+        dy.push_back(-1.0);
+    }
+    HighwayMap road;
+    road.build(x, y, s, dx, dy);
+    for (int i = 0; i + 1 < road.size(); i++)
+        for (double off: {0.0, 3.0, -7.0, 250.0})
+            check("ties road", road, 10.0 * i + 5.0, off);
+
+    // a zigzag, the centers between four waypoints are at the same distance from all of them
+    x.clear(), y.clear(), s.clear(), dx.clear(), dy.clear();
+    for (int i = 0; i < 60; i++) {
+        x.push_back(4.0 * (i / 2));
+        y.push_back(4.0 * (i % 2));
+        s.push_back(i);
+        dx.push_back(0.0);
+        dy.push_back(-1.0);
+    }
+    HighwayMap zigzag;
+    zigzag.build(x, y, s, dx, dy);
+    for (int i = 0; i + 2 < zigzag.size(); i++) {
+        check("ties zigzag", zigzag, zigzag.x()[i] + 2.0, 2.0);
+        check("ties zigzag", zigzag, zigzag.x()[i], 2.0);
+    }
+}
+
+// a route with waypoints ~30m apart and a slowly wandering heading, like map_benchmark
+void syntheticRoute(int n, HighwayMap &map) {
+    vector<double> x(n), y(n), s(n), dx(n), dy(n);
+    double heading = 0.0, px = 0.0, py = 0.0, ps = 0.0;
+    for (int i = 0; i < n; i++) {
+        heading = 0.6 * sin(i / 150.0) + 0.3 * sin(i / 1700.0);
+        x[i] = px;
+        y[i] = py;
+        s[i] = ps;
+        dx[i] = sin(heading);
+        dy[i] = -cos(heading);
+        px += 30.0 * cos(heading);
+        py += 30.0 * sin(heading);
+        ps += 30.0;
+    }
+    map.build(x, y, s, dx, dy);
+}
+
+}
+
+int main(int argc, char **argv) {
+
+    string map_file = argc > 1 ? argv[1] : "../highway_map_bosch1.csv";
+
+    HighwayMap bosch;
+    if (!bosch.load(map_file)) {
+        printf("could not read %s\n", map_file.c_str());
+        return 1;
+    }
+    checkRandom("bosch", bosch, 20000);
+
+    HighwayMap synthetic;
+    syntheticRoute(20000, synthetic);
+    checkRandom("synthetic", synthetic, 20000);
+
+    checkTies();
+
+    printf("%d mismatches\n", failures);
+    return failures > 0 ? 1 : 0;
+}
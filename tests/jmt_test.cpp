@@ -0,0 +1,241 @@
+// The jerk-minimizing trajectory solvers and the lattice planner's vectorized cost against scalar references.
+//
+// Checks
+//   - solveJMTBatch() against solveJMT() one end state at a time, for random boundary conditions and batch
+//     sizes around the block of 64 end states, and that every quintic meets its start and end state,
+//   - sampleJMT() on a quintic shorter than the samples, which holds the end speed past T,
+//   - LatticePlanner::evaluate() against the cost of every candidate computed one sample at a time like
+//     calculateCost() walks a trajectory, and skip() and best() against a plain scan of the costs.
+// Prints every mismatch and fails if there is any.
+
+#include <math.h>
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+#include "../src/jmt.h"
+#include "../src/lattice_planner.h"
+#include "../src/trajectory_buffer.h"
+
+using namespace std;
+
+namespace {
+
+int failures = 0;
+
+void check(const char *name, double value, double expected, double tolerance) {
+    if (!(fabs(value - expected) <= tolerance * max(1.0, fabs(expected)))) {
+        printf("%s: %.17g, expected %.17g\n", name, value, expected);
+        failures++;
+    }
+}
+
+JMTState randomState(mt19937 &gen) {
+    uniform_real_distribution<double> p_dist(-100.0, 100.0), v_dist(-5.0, 25.0), a_dist(-8.0, 8.0);
+    return {p_dist(gen), v_dist(gen), a_dist(gen)};
+}
+
+void checkBatch(mt19937 &gen, int n) {
+
+    JMTState start = randomState(gen);
+    double T = uniform_real_distribution<double>(0.5, 5.0)(gen);
+    vector<JMTState> end(n);
+    for (auto &e: end)
+        e = randomState(gen);
+
+    vector<Quintic> batch(n);
+    solveJMTBatch(start, end.data(), n, T, batch.data());
+    for (int k = 0; k < n; k++) {
+        Quintic q = solveJMT(start, end[k], T);
+        for (int i = 0; i < 6; i++)
+            check("solveJMTBatch coefficient", batch[k].c[i], q.c[i], 1e-12);
+
+        check("quintic start p", batch[k](0.0), start.p, 1e-12);
+        check("quintic start v", batch[k].deriv(0.0, 1), start.v, 1e-12);
+        check("quintic start a", batch[k].deriv(0.0, 2), start.a, 1e-12);
+        check("quintic end p", batch[k](T), end[k].p, 1e-9);
+        check("quintic end v", batch[k].deriv(T, 1), end[k].v, 1e-9);
+        check("quintic end a", batch[k].deriv(T, 2), end[k].a, 1e-9);
+    }
+}
+
+void checkSample(mt19937 &gen) {
+
+    JMTState start = randomState(gen), end = randomState(gen);
+    double T = uniform_real_distribution<double>(0.5, 2.0)(gen);
+    Quintic q = solveJMT(start, end, T);
+
+    // 0.02s samples over 3s, the last ones well past T, from a start time that is not a multiple of dt
+    const double t0 = 0.013, dt = 0.02;
+    const int n = 150;
+    vector<double> p(n), v(n), a(n), j(n);
+    sampleJMT(q, T, t0, dt, n, p.data(), v.data(), a.data(), j.data());
+
+    for (int k = 0; k < n; k++) {
+        double t = t0 + k * dt;
+        if (t <= T) {
+            check("sampleJMT p", p[k], q(t), 1e-12);
+            check("sampleJMT v", v[k], q.deriv(t, 1), 1e-12);
+            check("sampleJMT a", a[k], q.deriv(t, 2), 1e-12);
+            check("sampleJMT j", j[k], q.deriv(t, 3), 1e-12);
+        } else {
+            check("sampleJMT held p", p[k], end.p + end.v * (t - T), 1e-9);
+            check("sampleJMT held v", v[k], end.v, 1e-9);
+            check("sampleJMT held a", a[k], 0.0, 0.0);
+            check("sampleJMT held j", j[k], 0.0, 0.0);
+        }
+    }
+}
+
+// cost of candidate (m, l, v) one sample at a time
+double candidateCost(const LatticePlanner &lattice, const JMTState &start_s, const JMTState &start_d, int m, int l,
+                     int v, const LatticeTraffic &traffic, double time_offset, int goal_lane) {
+
+    const LatticeConfig &config = lattice.config();
+    double T = lattice.duration(m), target = lattice.speed(v), w = config.lane_width;
+    Quintic qs = solveJMT(start_s, {start_s.p + T * (start_s.v + target) / 2, target, 0.0}, T);
+    Quintic qd = solveJMT(start_d, {(l + 0.5) * w, 0.0, 0.0}, T);
+
+    int samples = config.samples();
+    double v_max = 0.0, a_max = 0.0, j_max = 0.0, collision = 0.0;
+    bool off_road = false;
+    for (int k = 0; k < samples; k++) {
+        double t = k * config.dt;
+        double ps, vs, as, js, pd, vd, ad, jd;
+        sampleJMT(qs, T, t, 0.0, 1, &ps, &vs, &as, &js);
+        sampleJMT(qd, T, t, 0.0, 1, &pd, &vd, &ad, &jd);
+        v_max = max(v_max, sqrt(vs * vs + vd * vd));
+        a_max = max(a_max, sqrt(as * as + ad * ad));
+        j_max = max(j_max, sqrt(js * js + jd * jd));
+
+        int lo = int(floor((pd - 1.0) / w)), hi = int(floor((pd + 1.0) / w));
+        off_road |= lo < 0 || hi >= config.lanes;
+        for (int i = 0; i < traffic.size; i++) {
+            int car_lane = int(floor(traffic.d[i] / w));
+            double gap = ps - (traffic.s[i] + traffic.v[i] * (time_offset + t));
+            if (car_lane >= lo && car_lane <= hi && gap > -config.gap_ahead && gap < config.gap_behind)
+                collision = max(collision, 10.0 + double(samples - k) / samples);
+        }
+    }
+
+    double cost = (off_road ? 10.0 : 0.0) + abs(l - goal_lane) * config.lane_change_cost + collision;
+    if (v_max > config.speed_limit)
+        cost += 10.0;
+    if (a_max > config.accel_limit)
+        cost += 10.0;
+    if (j_max > config.jerk_limit)
+        cost += 10.0;
+    cost += abs(config.speed_limit - target) / config.speed_limit;
+    cost += 0.1 * (a_max / config.accel_limit + j_max / config.jerk_limit);
+    return cost;
+}
+
+// first cheapest candidate, infinity for the skipped ones
+int firstCheapest(const double *cost, int n) {
+    int best = 0;
+    for (int c = 1; c < n; c++)
+        if (cost[c] < cost[best])
+            best = c;
+    return best;
+}
+
+void checkLattice(mt19937 &gen, TickArena &arena) {
+
+    LatticePlanner lattice;
+    const LatticeConfig &config = lattice.config();
+
+    // the ego anywhere on the road at highway speed, cars around it
+    JMTState start_s = {uniform_real_distribution<double>(0.0, 1000.0)(gen),
+                        uniform_real_distribution<double>(5.0, 22.0)(gen),
+                        uniform_real_distribution<double>(-3.0, 3.0)(gen)};
+    JMTState start_d = {uniform_real_distribution<double>(1.0, 11.0)(gen),
+                        uniform_real_distribution<double>(-1.0, 1.0)(gen), 0.0};
+    int goal_lane = uniform_int_distribution<int>(0, config.lanes - 1)(gen);
+    double time_offset = uniform_real_distribution<double>(0.0, 1.0)(gen);
+
+    const int cars = 12;
+    vector<double> car_s(cars), car_v(cars), car_d(cars);
+    for (int i = 0; i < cars; i++) {
+        car_s[i] = start_s.p + uniform_real_distribution<double>(-40.0, 120.0)(gen);
+        car_v[i] = uniform_real_distribution<double>(5.0, 22.0)(gen);
+        car_d[i] = uniform_real_distribution<double>(0.5, 11.5)(gen);
+    }
+    LatticeTraffic traffic;
+    traffic.s = car_s.data();
+    traffic.v = car_v.data();
+    traffic.d = car_d.data();
+    traffic.size = cars;
+
+    LatticeCandidates candidates;
+    lattice.prepare(start_s, start_d, arena, candidates);
+    for (int m = 0; m < config.durations; m++)
+        lattice.evaluate(m, traffic, time_offset, goal_lane, arena, candidates);
+
+    for (int c = 0; c < candidates.size; c++) {
+        int l, v, m;
+        lattice.split(c, l, v, m);
+        check("lattice cost", candidates.cost[c],
+              candidateCost(lattice, start_s, start_d, m, l, v, traffic, time_offset, goal_lane), 1e-9);
+    }
+    if (lattice.best(candidates) != firstCheapest(candidates.cost, candidates.size)) {
+        printf("best: %d, expected %d\n", lattice.best(candidates), firstCheapest(candidates.cost, candidates.size));
+        failures++;
+    }
+
+    // on a tie the first candidate wins
+    int tied = firstCheapest(candidates.cost, candidates.size);
+    if (tied > 0) {
+        int earlier = uniform_int_distribution<int>(0, tied - 1)(gen);
+        candidates.cost[earlier] = candidates.cost[tied];
+        if (lattice.best(candidates) != earlier) {
+            printf("best on a tie: %d, expected %d\n", lattice.best(candidates), earlier);
+            failures++;
+        }
+    }
+
+    // skipped durations cost infinity, the others keep their cost
+    vector<double> evaluated(candidates.cost, candidates.cost + candidates.size);
+    vector<bool> skipped(config.durations);
+    for (int m = 0; m < config.durations; m++) {
+        skipped[m] = uniform_int_distribution<int>(0, 1)(gen) == 1;
+        if (skipped[m])
+            lattice.skip(m, candidates);
+    }
+    for (int c = 0; c < candidates.size; c++) {
+        int l, v, m;
+        lattice.split(c, l, v, m);
+        double expected = skipped[m] ? numeric_limits<double>::infinity() : evaluated[c];
+        if (candidates.cost[c] != expected) {
+            printf("skip: candidate %d costs %.17g, expected %.17g\n", c, candidates.cost[c], expected);
+            failures++;
+        }
+    }
+    if (lattice.best(candidates) != firstCheapest(candidates.cost, candidates.size)) {
+        printf("best after skip: %d, expected %d\n", lattice.best(candidates),
+               firstCheapest(candidates.cost, candidates.size));
+        failures++;
+    }
+}
+
+}
+
+int main() {
+
+    mt19937 gen(5);
+    for (int n: {1, 2, 63, 64, 65, 127, 128, 200})
+        for (int i = 0; i < 20; i++)
+            checkBatch(gen, n);
+
+    for (int i = 0; i < 1000; i++)
+        checkSample(gen);
+
+    TickArena arena;
+    for (int i = 0; i < 200; i++) {
+        checkLattice(gen, arena);
+        arena.reset();
+    }
+
+    printf("%d mismatches\n", failures);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+// tk::fixed_spline<N>, the batch evaluation and the derivatives of spline.h against tk::spline itself.
+//
+// Fits both splines through random points laid out like the planner's (increasing x, a few to tens of
+// meters apart) with every boundary condition, and checks
+//   - fixed_spline<N> against spline at the points, between them and past both ends,
+//   - eval() and eval_sorted() of both against their operator(), which have to agree exactly,
+//   - deriv() and curvature() of both against finite differences of spline's operator(). Inside one
+//     piece the spline is a cubic, so the differences below are exact up to rounding.
+// Prints the largest errors and every check over its tolerance, and fails if there is any.
+
+#include <math.h>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "../src/spline.h"
+
+using namespace std;
+
+namespace {
+
+int failures = 0;
+
+const int kPoints = 5;
+
+// largest error of each check, relative to the magnitude of the expected value when that is above 1
+double max_fixed = 0.0, max_eval = 0.0, max_sorted = 0.0, max_deriv[4] = {0.0, 0.0, 0.0, 0.0}, max_curvature = 0.0;
+
+void check(const char *name, double x, double value, double expected, double tolerance, double &max_error) {
+    double error = fabs(value - expected) / max(1.0, fabs(expected));
+    max_error = max(max_error, error);
+    if (!(error <= tolerance)) {
+        printf("%s at %.17g: %.17g, expected %.17g\n", name, x, value, expected);
+        failures++;
+    }
+}
+
+// derivatives of spline's operator() at x by central differences over up to 2h, exact for a cubic
+double difference(const tk::spline &s, double x, double h, int order) {
+    if (order == 1)
+        return (s(x - 2.0 * h) - 8.0 * s(x - h) + 8.0 * s(x + h) - s(x + 2.0 * h)) / (12.0 * h);
+    if (order == 2)
+        return (s(x + h) - 2.0 * s(x) + s(x - h)) / (h * h);
+    return (s(x + 2.0 * h) - 2.0 * s(x + h) + 2.0 * s(x - h) - s(x - 2.0 * h)) / (2.0 * h * h * h);
+}
+
+template<class Spline>
+void checkBatch(const char *name, const Spline &s, const vector<double> &xs) {
+
+    vector<double> out(xs.size());
+    s.eval(xs.data(), xs.size(), out.data());
+    for (size_t i = 0; i < xs.size(); i++)
+        check(name, xs[i], out[i], s(xs[i]), 0.0, max_eval);
+
+    vector<double> sorted(xs);
+    sort(sorted.begin(), sorted.end());
+    s.eval_sorted(sorted.data(), sorted.size(), out.data());
+    for (size_t i = 0; i < sorted.size(); i++)
+        check(name, sorted[i], out[i], s(sorted[i]), 0.0, max_sorted);
+}
+
+template<class Spline>
+void checkDerivatives(const char *name, const Spline &s, const tk::spline &reference, double x, double h) {
+    // the third difference divides the rounding of operator() by h^3
+    for (int order = 1; order <= 3; order++)
+        check(name, x, s.deriv(x, order), difference(reference, x, h, order), order < 3 ? 1e-6 : 1e-4, max_deriv[order]);
+
+    double d1 = difference(reference, x, h, 1), d2 = difference(reference, x, h, 2);
+    check(name, x, s.curvature(x), d2 / pow(1.0 + d1 * d1, 1.5), 1e-6, max_curvature);
+}
+
+void checkLayout(mt19937 &gen, tk::spline::bd_type left, double left_value, tk::spline::bd_type right,
+                 double right_value, bool cubic) {
+
+    uniform_real_distribution<double> gap_dist(0.5, 40.0);
+    uniform_real_distribution<double> y_dist(-10.0, 10.0);
+    vector<double> x(kPoints), y(kPoints);
+    x[0] = uniform_real_distribution<double>(-50.0, 50.0)(gen);
+    for (int i = 0; i < kPoints; i++) {
+        if (i > 0)
+            x[i] = x[i - 1] + gap_dist(gen);
+        y[i] = y_dist(gen);
+    }
+
+    tk::spline reference;
+    reference.set_boundary(left, left_value, right, right_value);
+    reference.set_points(x, y, cubic);
+
+    tk::fixed_spline<kPoints> fixed;
+    fixed.set_boundary(left, left_value, right, right_value);
+    fixed.set_points(x.data(), y.data(), cubic);
+
+    // the points themselves, random points between and past them
+    vector<double> xs(x);
+    uniform_real_distribution<double> x_dist(x.front() - 20.0, x.back() + 20.0);
+    for (int i = 0; i < 200; i++)
+        xs.push_back(x_dist(gen));
+    for (double q: xs)
+        check("fixed_spline", q, fixed(q), reference(q), 1e-12, max_fixed);
+
+    checkBatch("spline batch", reference, xs);
+    checkBatch("fixed_spline batch", fixed, xs);
+
+    // derivatives inside each piece and in both extrapolations, at least 2h away from the points where
+    // the third derivative jumps
+    const double h = 0.02;
+    uniform_real_distribution<double> t_dist(0.0, 1.0);
+    for (int piece = -1; piece < kPoints; piece++) {
+        double lo = piece < 0 ? x.front() - 20.0 : x[piece];
+        double hi = piece + 1 < kPoints ? x[piece + 1] : x.back() + 20.0;
+        for (int i = 0; i < 20; i++) {
+            double q = lo + 2.0 * h + t_dist(gen) * (hi - lo - 4.0 * h);
+            checkDerivatives("spline deriv", reference, reference, q, h);
+            checkDerivatives("fixed_spline deriv", fixed, reference, q, h);
+        }
+    }
+}
+
+}
+
+int main() {
+
+    mt19937 gen(11);
+    uniform_real_distribution<double> value_dist(-0.2, 0.2);
+    for (int layout = 0; layout < 500; layout++) {
+        checkLayout(gen, tk::spline::second_deriv, 0.0, tk::spline::second_deriv, 0.0, true);
+        checkLayout(gen, tk::spline::second_deriv, value_dist(gen), tk::spline::second_deriv, 0.0, true);
+        checkLayout(gen, tk::spline::first_deriv, value_dist(gen), tk::spline::first_deriv, value_dist(gen), true);
+        checkLayout(gen, tk::spline::second_deriv, 0.0, tk::spline::second_deriv, 0.0, false);
+    }
+
+    printf("max error: fixed_spline %.2g, eval %.2g, eval_sorted %.2g, deriv %.2g %.2g %.2g, curvature %.2g\n",
+           max_fixed, max_eval, max_sorted, max_deriv[1], max_deriv[2], max_deriv[3], max_curvature);
+    printf("%d mismatches\n", failures);
+    return failures > 0 ? 1 : 0;
+}
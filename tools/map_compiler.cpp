@@ -0,0 +1,112 @@
+// Compile a CSV map file into the binary map format HighwayMap::load() maps into memory.
+//
+// The compiled file holds the waypoints and all tables derived from them, it is read back
+// and compared against the CSV before the tool reports success. With --header the tables are
+// written as a C++ header instead, which the EMBED_MAP build compiles into path_planning.
+//
+// usage: map_compiler [--header] <map.csv> <map.bin|map.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "../src/highway_map.h"
+
+using namespace std;
+
+namespace {
+
+bool sameTable(const TableView<double> &a, const TableView<double> &b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i] != b[i])
+            return false;
+    return true;
+}
+
+template<typename T>
+void writeArray(ofstream &out, const char *type, const char *name, const T *values, int n, const char *format) {
+    char value[32];
+    out << "constexpr " << type << " " << name << "[" << n << "] = {";
+    for (int i = 0; i < n; i++) {
+        snprintf(value, sizeof(value), format, values[i]);
+        out << (i % 8 == 0 ? "\n    " : " ") << value << ",";
+    }
+    out << "\n};\n\n";
+}
+
+// constexpr arrays of the tables, exact since doubles are printed with 17 significant digits
+bool writeHeader(const HighwayMap &map, const string &csv_file, const string &header_file) {
+
+    MapTables tables = map.tables();
+    int cells = tables.grid_cols * tables.grid_rows;
+    char line[256];
+
+    ofstream out(header_file.c_str(), ofstream::out | ofstream::trunc);
+    out << "// Generated by tools/map_compiler --header from " << csv_file << ", do not edit.\n\n";
+    out << "#ifndef EMBEDDED_MAP_H\n#define EMBEDDED_MAP_H\n\n#include \"map_file.h\"\n\n";
+    out << "namespace embedded_map {\n\n";
+    out << "constexpr int kWaypoints = " << tables.waypoints << ";\n";
+    out << "constexpr int kTables = " << tables.tables << ";\n\n";
+    writeArray(out, "double", "kTableBlock", tables.table_block, tables.tables * tables.waypoints, "%.17g");
+    writeArray(out, "int32_t", "kGridStart", tables.grid_start, cells + 1, "%d");
+    writeArray(out, "int32_t", "kGridItems", tables.grid_items, tables.waypoints, "%d");
+    snprintf(line, sizeof(line), "constexpr MapTables kMap = {kWaypoints, kTables, kTableBlock, %d, %d, %.17g, %.17g, %.17g,\n"
+             "                            kGridStart, kGridItems};\n\n", tables.grid_cols, tables.grid_rows,
+             tables.grid_cell, tables.grid_min_x, tables.grid_min_y);
+    out << line;
+    out << "}\n\n#endif /* EMBEDDED_MAP_H */\n";
+
+    return bool(out.flush());
+}
+
+}
+
+int main(int argc, char **argv) {
+
+    bool header = argc > 1 && strcmp(argv[1], "--header") == 0;
+    if (argc != 3 + header) {
+        fprintf(stderr, "usage: %s [--header] <map.csv> <map.bin|map.h>\n", argv[0]);
+        return 2;
+    }
+    string csv_file = argv[1 + header];
+    string bin_file = argv[2 + header];
+
+    HighwayMap map;
+    if (!map.load(csv_file)) {
+        fprintf(stderr, "could not read %s\n", csv_file.c_str());
+        return 1;
+    }
+
+    if (header) {
+        if (!writeHeader(map, csv_file, bin_file)) {
+            fprintf(stderr, "could not write %s\n", bin_file.c_str());
+            return 1;
+        }
+        printf("%s: %d waypoints -> %s\n", csv_file.c_str(), map.size(), bin_file.c_str());
+        return 0;
+    }
+    if (!map.save(bin_file)) {
+        fprintf(stderr, "could not write %s\n", bin_file.c_str());
+        return 1;
+    }
+
+    HighwayMap compiled;
+    if (!compiled.load(bin_file) || !compiled.mapped()) {
+        fprintf(stderr, "could not map %s\n", bin_file.c_str());
+        return 1;
+    }
+    bool same = sameTable(map.x(), compiled.x()) && sameTable(map.y(), compiled.y()) &&
+                sameTable(map.s(), compiled.s()) && sameTable(map.dx(), compiled.dx()) &&
+                sameTable(map.dy(), compiled.dy());
+    for (int i = 0; same && i < map.size(); i++)
+        same = compiled.ClosestWaypoint(map.x()[i], map.y()[i]) == map.ClosestWaypoint(map.x()[i], map.y()[i]);
+    if (!same) {
+        fprintf(stderr, "%s does not match %s\n", bin_file.c_str(), csv_file.c_str());
+        return 1;
+    }
+
+    printf("%s: %d waypoints -> %s\n", csv_file.c_str(), map.size(), bin_file.c_str());
+    return 0;
+}
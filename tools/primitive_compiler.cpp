@@ -0,0 +1,64 @@
+// Precompute the motion primitive library path_planning --trajectory=primitives places instead of
+// fitting trajectories.
+//
+// Every lane change and speed change of the grid is solved for every duration, validated against the
+// speed, acceleration and jerk limits and written to the binary library format, which is read back and
+// compared before the tool reports success.
+//
+// usage: primitive_compiler <primitives.bin>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../src/primitive_library.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <primitives.bin>\n", argv[0]);
+        return 2;
+    }
+    string bin_file = argv[1];
+
+    PrimitiveGrid grid;
+    PrimitiveLibrary library;
+    library.build(grid);
+
+    if (!library.save(bin_file)) {
+        fprintf(stderr, "could not write %s\n", bin_file.c_str());
+        return 1;
+    }
+
+    PrimitiveLibrary compiled;
+    if (!compiled.load(bin_file) || !compiled.mapped()) {
+        fprintf(stderr, "could not map %s\n", bin_file.c_str());
+        return 1;
+    }
+
+    // how many primitives are valid for some initial speed, per lane change
+    vector<int> valid(grid.laneChanges(), 0);
+    bool same = true;
+    for (int l = -grid.lanes; l <= grid.lanes; l++) {
+        for (int v = 0; v < grid.speed_changes; v++) {
+            for (int m = 0; m < grid.durations; m++) {
+                const MotionPrimitive &a = library.at(l, v, m), &b = compiled.at(l, v, m);
+                same = same && memcmp(&a, &b, sizeof(a)) == 0;
+                if (a.v0_min <= a.v0_max)
+                    valid[l + grid.lanes]++;
+            }
+        }
+    }
+    if (!same) {
+        fprintf(stderr, "%s does not match the primitives it was written from\n", bin_file.c_str());
+        return 1;
+    }
+
+    printf("%d primitives, %d bytes -> %s\n", grid.size(), int(grid.size() * sizeof(MotionPrimitive)), bin_file.c_str());
+    for (int l = -grid.lanes; l <= grid.lanes; l++)
+        printf("  lane change %+d: %d of %d within %.1f m/s^2, %.1f m/s^3\n", l, valid[l + grid.lanes],
+               grid.speed_changes * grid.durations, grid.margin * grid.accel_limit, grid.margin * grid.jerk_limit);
+    return 0;
+}